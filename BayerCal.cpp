@@ -0,0 +1,261 @@
+#include "bayercal.h"
+
+// calibration file layout: header followed by the dark frame and
+// flat field frames (width * height unsigned shorts each) when present
+#define BAYERCAL_MAGIC 0x4C414342	// "BCAL"
+#define BAYERCAL_VERSION 1
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	int32_t width, height;
+	int32_t black[BayerCal::CH_COUNT];
+	int32_t hasDark, hasFlat;
+} BAYERCAL_FILEHEADER;
+
+BayerCal::BayerCal()
+{
+	m_Width = 0; m_Height = 0;
+	m_Enabled = true;
+	for (int c = 0; c < CH_COUNT; c++)
+		m_Black[c] = 0;
+	m_AccumCount = 0;
+}
+BayerCal::~BayerCal()
+{
+}
+BayerCal::ERR BayerCal::SetSize(int width, int height)
+{
+	if ((width <= 0) || (height <= 0) || (width & 1) || (height & 1))
+	{
+		fprintf(stderr,"Error: Calibration size must be even");
+		return FAIL;
+	}
+	m_Width = width;
+	m_Height = height;
+	m_Dark.clear();
+	m_Flat.clear();
+	m_Accum.clear();
+	m_AccumCount = 0;
+	Prepare();
+	return OK;
+}
+void BayerCal::SetBlackLevel(int channel, int level)
+{
+	if ((channel < 0) || (channel >= CH_COUNT))
+		return;
+	m_Black[channel] = level;
+	Prepare();
+}
+int BayerCal::GetBlackLevel(int channel)
+{
+	if ((channel < 0) || (channel >= CH_COUNT))
+		return -1;
+	return m_Black[channel];
+}
+void BayerCal::BeginDark()
+{
+	m_Accum.assign(m_Width * m_Height, 0);
+	m_AccumCount = 0;
+}
+BayerCal::ERR BayerCal::AddDark(uint8_t *src, int srcLen)
+{
+	return Accumulate(src, srcLen);
+}
+BayerCal::ERR BayerCal::EndDark()
+{
+	if (m_AccumCount == 0)
+	{
+		fprintf(stderr,"Error: No Dark Frames Captured");
+		return FAIL;
+	}
+	int n = m_Width * m_Height;
+	int half = m_AccumCount / 2;
+	double sum[CH_COUNT] = {0.0, 0.0, 0.0, 0.0};
+	m_Dark.resize(n);
+	for (int y = 0; y < m_Height; y++)
+	{
+		for (int x = 0; x < m_Width; x++)
+		{
+			int i = x + m_Width * y;
+			m_Dark[i] = (unsigned short)((m_Accum[i] + half) / m_AccumCount);
+			sum[Channel(x, y)] += m_Dark[i];
+		}
+	}
+	// each channel holds a quarter of the sites
+	for (int c = 0; c < CH_COUNT; c++)
+		m_Black[c] = (int)(sum[c] * 4.0 / n + 0.5);
+	m_Accum.clear();
+	m_AccumCount = 0;
+	Prepare();
+	fprintf(stderr,"Dark frame: black levels B %d G %d IR %d R %d\n",
+		m_Black[CH_B], m_Black[CH_G], m_Black[CH_IR], m_Black[CH_R]);
+	return OK;
+}
+void BayerCal::ClearDark()
+{
+	m_Dark.clear();
+	Prepare();
+}
+void BayerCal::BeginFlat()
+{
+	BeginDark();
+}
+BayerCal::ERR BayerCal::AddFlat(uint8_t *src, int srcLen)
+{
+	return Accumulate(src, srcLen);
+}
+BayerCal::ERR BayerCal::EndFlat()
+{
+	if (m_AccumCount == 0)
+	{
+		fprintf(stderr,"Error: No Flat Frames Captured");
+		return FAIL;
+	}
+	int n = m_Width * m_Height;
+	int half = m_AccumCount / 2;
+	m_Flat.resize(n);
+	for (int i = 0; i < n; i++)
+		m_Flat[i] = (unsigned short)((m_Accum[i] + half) / m_AccumCount);
+	m_Accum.clear();
+	m_AccumCount = 0;
+	Prepare();
+	return OK;
+}
+void BayerCal::ClearFlat()
+{
+	m_Flat.clear();
+	Prepare();
+}
+BayerCal::ERR BayerCal::Save(std::string fileName)
+{
+	FILE *fp = fopen(fileName.data(), "wb");
+	if (fp == NULL)
+	{
+		fprintf(stderr,"Error: Unable to write %s", fileName.data());
+		return FAIL;
+	}
+	BAYERCAL_FILEHEADER hdr;
+	hdr.magic = BAYERCAL_MAGIC;
+	hdr.version = BAYERCAL_VERSION;
+	hdr.width = m_Width;
+	hdr.height = m_Height;
+	for (int c = 0; c < CH_COUNT; c++)
+		hdr.black[c] = m_Black[c];
+	hdr.hasDark = HasDark();
+	hdr.hasFlat = HasFlat();
+	bool ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1);
+	if (ok && hdr.hasDark)
+		ok = (fwrite(&m_Dark[0], sizeof(unsigned short), m_Dark.size(), fp) == m_Dark.size());
+	if (ok && hdr.hasFlat)
+		ok = (fwrite(&m_Flat[0], sizeof(unsigned short), m_Flat.size(), fp) == m_Flat.size());
+	fclose(fp);
+	if (!ok)
+	{
+		fprintf(stderr,"Error: Writing %s", fileName.data());
+		return FAIL;
+	}
+	return OK;
+}
+BayerCal::ERR BayerCal::Load(std::string fileName)
+{
+	FILE *fp = fopen(fileName.data(), "rb");
+	if (fp == NULL)
+		return FAIL;	// no calibration for this camera yet
+	BAYERCAL_FILEHEADER hdr;
+	bool ok = (fread(&hdr, sizeof(hdr), 1, fp) == 1)
+		&& (hdr.magic == BAYERCAL_MAGIC) && (hdr.version == BAYERCAL_VERSION);
+	if (ok)
+		ok = (SetSize(hdr.width, hdr.height) == OK);
+	int n = m_Width * m_Height;
+	if (ok && hdr.hasDark)
+	{
+		m_Dark.resize(n);
+		ok = (fread(&m_Dark[0], sizeof(unsigned short), n, fp) == (size_t)n);
+	}
+	if (ok && hdr.hasFlat)
+	{
+		m_Flat.resize(n);
+		ok = (fread(&m_Flat[0], sizeof(unsigned short), n, fp) == (size_t)n);
+	}
+	fclose(fp);
+	if (!ok)
+	{
+		fprintf(stderr,"Error: Reading %s", fileName.data());
+		m_Dark.clear();
+		m_Flat.clear();
+		Prepare();
+		return FAIL;
+	}
+	for (int c = 0; c < CH_COUNT; c++)
+		m_Black[c] = hdr.black[c];
+	Prepare();
+	return OK;
+}
+
+// ************************************************************************
+// ***************  Protected Methods for BayerCal  ***********************
+// ************************************************************************
+BayerCal::ERR BayerCal::Accumulate(uint8_t *src, int srcLen)
+{
+	int n = m_Width * m_Height;
+	if ((src == NULL) || (srcLen < (int)(n * sizeof(unsigned short))) || ((int)m_Accum.size() != n))
+	{
+		fprintf(stderr,"Error: Calibration frame does not match");
+		return FAIL;
+	}
+	unsigned short *pSrc = (unsigned short *)src;
+	uint32_t *pAcc = &m_Accum[0];
+	for (int i = 0; i < n; i++)
+		pAcc[i] += pSrc[i];
+	m_AccumCount++;
+	return OK;
+}
+void BayerCal::Prepare()
+{
+	int n = m_Width * m_Height;
+	m_Offset.resize(n);
+	m_Gain.resize(n);
+	if (n == 0)
+		return;
+	int x, y, i;
+	for (y = 0; y < m_Height; y++)
+	{
+		for (x = 0; x < m_Width; x++)
+		{
+			i = x + m_Width * y;
+			m_Offset[i] = HasDark() ? m_Dark[i] : (unsigned short)m_Black[Channel(x, y)];
+			m_Gain[i] = BAYERCAL_GAIN_ONE;
+		}
+	}
+	if (!HasFlat())
+		return;
+	// gain brings every site up or down to the mean response of its channel
+	double sum[CH_COUNT] = {0.0, 0.0, 0.0, 0.0};
+	int signal;
+	for (y = 0; y < m_Height; y++)
+	{
+		for (x = 0; x < m_Width; x++)
+		{
+			i = x + m_Width * y;
+			signal = (int)m_Flat[i] - (int)m_Offset[i];
+			sum[Channel(x, y)] += (signal > 0) ? signal : 0;
+		}
+	}
+	double mean[CH_COUNT];
+	for (int c = 0; c < CH_COUNT; c++)
+		mean[c] = sum[c] * 4.0 / n;
+	double g;
+	for (y = 0; y < m_Height; y++)
+	{
+		for (x = 0; x < m_Width; x++)
+		{
+			i = x + m_Width * y;
+			signal = (int)m_Flat[i] - (int)m_Offset[i];
+			if (signal <= 0)
+				continue;	// dead in the flat, leave it alone
+			g = BAYERCAL_GAIN_ONE * mean[Channel(x, y)] / signal + 0.5;
+			m_Gain[i] = (unsigned short)((g > BAYERCAL_GAIN_MAX) ? BAYERCAL_GAIN_MAX : g);
+		}
+	}
+}
@@ -0,0 +1,481 @@
+#include "bayerextract.h"
+#include <string.h>
+
+// ***********************************************************************
+// ******** Routine to turn buffers of Bayer data into cv::Mats **********
+// ***********************************************************************
+//Macros to assist in Bayer Conversion
+#define B(x,y,w) pDstRGB[0 + 3 * ((x) + (w) * (y))] 
+#define G(x,y,w) pDstRGB[1 + 3 * ((x) + (w) * (y))] 
+#define R(x,y,w) pDstRGB[2 + 3 * ((x) + (w) * (y))] 
+#define IR(x,y,w) pDstIR[0 +     ((x) + (w) * (y))] 
+#define BAY(x,y,w) pSrc[(x) + (w) * (y)]
+#define CLIP(x) ((x) < 0 ? 0 : ((x) >= 255 ? 255 : (x)))
+#define CLIP10(x) ((x) < 0 ? 0 : ((x) >= 1023 ? 1023 : (x)))
+float IRGain[3] = {1.0f, 1.0f, 1.0f};	// IR subtracted from B, G, R
+
+// Read the four sites of the 2x2 cell at (x,y) into sB,sG,sIR,sR
+// applying the black level / dark frame / flat field of pCal if there is one
+// w is the frame width and o the offset of pSrc in the frame, for regions
+#define READCELL(x,y,w,o) \
+	sB = BAY(x,y,w); sG = BAY((x)+1,y,w); sIR = BAY(x,(y)+1,w); sR = BAY((x)+1,(y)+1,w); \
+	if (pCal) \
+	{ \
+		i = (o) + (x) + (w) * (y); \
+		sB = pCal->Correct(sB, i);      sG = pCal->Correct(sG, i + 1); \
+		sIR = pCal->Correct(sIR, i + (w)); sR = pCal->Correct(sR, i + (w) + 1); \
+	}
+// Add the cell read by READCELL to pStats, clipping is taken from the raw sites
+#define STATCELL(x,y,w) \
+	pStats->AddCell(sB, sG, sIR, sR, BAY(x,y,w), BAY((x)+1,y,w), BAY(x,(y)+1,w), BAY((x)+1,(y)+1,w))
+
+// Extract 10 bit data from Y16 to 8 bit data RGB8 and IR8
+// No gain is applied and [0..255] of the [0..1023] range is all that is used
+static cv::Point2i ExtractBayerY16toRGB8(cv::Mat &dstRGB,cv::Mat &dstIR, uint8_t * src, int srcLen, cv::Point2i start,
+										  int stride, int offset, BayerCal *pCal, FrameStats *pStats, FramePyramid *pPyramid)
+{
+	cv::Point2i last;
+	unsigned char *pDstRGB;
+	unsigned char *pDstIR;
+	unsigned char *pHalfRGB = NULL, *pHalfIR = NULL;
+	unsigned short *pSrc = (unsigned short*) src + offset;
+	int x,y;
+	int srccnt = 0;	int width = dstRGB.cols;  int height = dstRGB.rows;
+	// itterate 2X2 to de-Bayer and spread out R,G,B elements to RGB and put IR to IR
+	// subtract the IR signal from all other sensor colors
+	unsigned short IRVal;
+	int sB, sG, sIR, sR, i;
+	int b, g, r;
+	for (y = start.y; (y < height) ; y+=2)
+	{
+		if( srccnt >= srcLen )
+			break;
+		pDstRGB = dstRGB.ptr(y);
+		pDstIR  = dstIR.ptr(y);
+		if (pPyramid)
+		{
+			pHalfRGB = pPyramid->LevelRGB(1).ptr(y >> 1);
+			pHalfIR = pPyramid->LevelIR(1).ptr(y >> 1);
+		}
+		for (x = start.x; (x < width) ; x+=2)
+		{
+			READCELL(x,y,stride,offset);
+			if (pStats)
+				STATCELL(x,y,stride);
+			IRVal = CLIP(sIR);
+			b = CLIP(sB - (int)(IRGain[0] * IRVal));
+			g = CLIP(sG - (int)(IRGain[1] * IRVal));
+			r = CLIP(sR - (int)(IRGain[2] * IRVal));
+			IR(x,0,width) = IR(x+1,0, width) = IR(x,1,width) = IR(x+1,1,width) = IRVal;
+			B(x,0,width)   = B(x+1,0, width) =  B(x,1,width) =  B(x+1,1,width) = b;
+			G(x,0,width)   = G(x+1,0, width) =  G(x,1,width) =  G(x+1,1,width) = g;
+			R(x,0,width)   = R(x+1,0, width) =  R(x,1,width) =  R(x+1,1,width) = r;
+			if (pHalfRGB)
+			{
+				// the cell is one pixel of the half resolution level
+				pHalfRGB[3 * (x >> 1)] = b; pHalfRGB[3 * (x >> 1) + 1] = g; pHalfRGB[3 * (x >> 1) + 2] = r;
+				pHalfIR[x >> 1] = IRVal;
+			}
+			srccnt+=8;	// used 4 bytes from two rows
+		}
+		if (pPyramid)
+			pPyramid->EndRow(y >> 1);
+	}
+	last.x = x; last.y = y;
+	return last;
+}
+// Extract 10 bit data from Y16 to 10 bit data RGB16 and IR16
+// No gain is applied and [0..1023] of the [0..1023] range is all used
+static cv::Point2i ExtractBayerY16toRGB16(cv::Mat &dstRGB,cv::Mat &dstIR, uint8_t * src, int srcLen, cv::Point2i start,
+										  int stride, int offset, BayerCal *pCal, FrameStats *pStats, FramePyramid *pPyramid)
+{
+	cv::Point2i last;
+	unsigned short *pDstRGB;
+	unsigned short *pDstIR;
+	unsigned short *pHalfRGB = NULL, *pHalfIR = NULL;
+	unsigned short *pSrc = (unsigned short*) src + offset;
+	int x,y;
+	int srccnt = 0;
+	int width = dstRGB.cols;  int height = dstRGB.rows;
+	short IRVal;
+	int sB, sG, sIR, sR, i;
+	int b, g, r, ir;
+	unsigned char * pBuf, *pDst;
+	// itterate 2X2 to de-Bayer and spread out R,G,B elements to RGB and put IR to IR
+	// elements are in Pattern  B G
+	//                         IR R
+	// subtract the IR signal from all other sensor colors
+	// To prevent overflow,  only use 9 bits of raw data 
+	for (y = start.y; (y < height) ; y+=2)
+	{
+		if( srccnt >= srcLen )
+			break;
+		pDstRGB = (unsigned short*)dstRGB.ptr(y);
+		pDstIR  = (unsigned short*)dstIR.ptr(y);
+		if (pPyramid)
+		{
+			pHalfRGB = (unsigned short*)pPyramid->LevelRGB(1).ptr(y >> 1);
+			pHalfIR = (unsigned short*)pPyramid->LevelIR(1).ptr(y >> 1);
+		}
+		for (x = start.x; (x < width) ; x+=2)
+		{
+			READCELL(x,y,stride,offset);
+			if (pStats)
+				STATCELL(x,y,stride);
+			IRVal = sIR;
+			b = CLIP10(2*(sB - (int)(IRGain[0] * IRVal)));
+			g = CLIP10(2*(sG - (int)(IRGain[1] * IRVal)));
+			r = CLIP10(2*(sR - (int)(IRGain[2] * IRVal)));
+			ir = CLIP10(2*IRVal);
+			B(x,0,width)   = B(x+1,0, width) =  B(x,1,width) =  B(x+1,1,width) = b;
+			G(x,0,width)   = G(x+1,0, width) =  G(x,1,width) =  G(x+1,1,width) = g;
+			R(x,0,width)   = R(x+1,0, width) =  R(x,1,width) =  R(x+1,1,width) = r;
+			IR(x,0,width) = IR(x+1,0, width) = IR(x,1,width) = IR(x+1,1,width) = ir;
+			if (pHalfRGB)
+			{
+				// the cell is one pixel of the half resolution level
+				pHalfRGB[3 * (x >> 1)] = b; pHalfRGB[3 * (x >> 1) + 1] = g; pHalfRGB[3 * (x >> 1) + 2] = r;
+				pHalfIR[x >> 1] = ir;
+			}
+			srccnt+=8;	// used 4 bytes from two rows
+		}
+		if (pPyramid)
+			pPyramid->EndRow(y >> 1);
+	}
+	last.x = x; last.y = y;
+	return last;
+}
+// CLIP10 without branches, noisy dark pixels go either way at random
+static inline int Clip10(int v)
+{
+	v &= ~(v >> 31);
+	v -= 1023;
+	return 1023 + (v & (v >> 31));
+}
+// Extract 10 bit data from Y16 straight to 8 bit YUV 4:2:0 (BT.601, video range)
+// The mosaic has one colour per 2x2 cell, which is the 4:2:0 chroma grid, so each
+// cell gives one U and V and its Y is repeated over the 4 pixels, as the RGB planes are
+static cv::Point2i ExtractBayerY16toYUV(cv::Mat &dstYUV, cv::Mat &dstIR, int width, int height, YUV_LAYOUT layout,
+										uint8_t * src, int srcLen, cv::Point2i start, const TransferTable *pCurve,
+										BayerCal *pCal, FrameStats *pStats)
+{
+	cv::Point2i last;
+	unsigned char *pY0, *pY1, *pU, *pV, *pIR0, *pIR1;
+	unsigned short *pSrc = (unsigned short*) src;
+	unsigned char *pChroma = dstYUV.data + width * height;
+	bool hasIR = !dstIR.empty();
+	int x,y;
+	int srccnt = 0;
+	int sB, sG, sIR, sR, i;
+	int b, g, r, yy, c;
+	// local copies: the byte stores below could alias anything the compiler would otherwise reload
+	// the cells are held to 10 bits, codes past the curve's range are white
+	unsigned char curve[1024];
+	int range = pCurve->InputRange();
+	for (i = 0; i < 1024; i++)
+		curve[i] = (unsigned char)pCurve->Lookup((i < range) ? i : range - 1);
+	float gainB = IRGain[0], gainG = IRGain[1], gainR = IRGain[2];
+	int step = (layout == YUV_NV12) ? 2 : 1;	// between chroma samples of a row
+	for (y = start.y; (y < height) ; y+=2)
+	{
+		if( srccnt >= srcLen )
+			break;
+		pY0 = dstYUV.ptr(y);
+		pY1 = dstYUV.ptr(y + 1);
+		if (layout == YUV_NV12)
+		{
+			pU = pChroma + (y / 2) * width;	// U V interleaved
+			pV = pU + 1;
+		}
+		else
+		{
+			pU = pChroma + (y / 2) * (width / 2);
+			pV = pU + (height / 2) * (width / 2);
+		}
+		pIR0 = hasIR ? dstIR.ptr(y) : NULL;
+		pIR1 = hasIR ? dstIR.ptr(y + 1) : NULL;
+		for (x = 0; (x < width) ; x+=2)
+		{
+			READCELL(x,y,width,0);
+			if (pStats)
+				STATCELL(x,y,width);
+			// same linear values as RGB16, then the curve to 8 bits
+			b = curve[Clip10(2*(sB - (int)(gainB * sIR)))];
+			g = curve[Clip10(2*(sG - (int)(gainG * sIR)))];
+			r = curve[Clip10(2*(sR - (int)(gainR * sIR)))];
+			yy = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+			pY0[x] = pY0[x + 1] = pY1[x] = pY1[x + 1] = (unsigned char)yy;
+			c = (x >> 1) * step;
+			pU[c] = (unsigned char)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+			pV[c] = (unsigned char)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+			if (hasIR)
+				pIR0[x] = pIR0[x + 1] = pIR1[x] = pIR1[x + 1] = curve[Clip10(2*sIR)];
+			srccnt+=8;	// used 4 bytes from two rows
+		}
+	}
+	last.x = 0; last.y = y;
+	return last;
+}
+// Patch the defects of the rows of this band and return the calibration to use, if any
+static BayerCal *PrepareBand(int width, int height, uint8_t * src, int srcLen, cv::Point2i start,
+							 BayerCal *pCal, DefectMap *pDefects)
+{
+	// patch the defective sites of the rows about to be extracted
+	if (pDefects && pDefects->Matches(width, height))
+	{
+		int yEnd = start.y + ((srcLen / (2 * width)) & ~1);
+		pDefects->Correct((unsigned short *)src, start.y, (yEnd < height) ? yEnd : height);
+	}
+	// only use calibration taken at this frame size
+	if (pCal && (!pCal->Enabled() || !pCal->Matches(width, height)))
+		pCal = NULL;
+	return pCal;
+}
+// pStats, if given, gets the statistics of this band added to it
+// pPyramid, if given, gets the reduced levels of the rows of this band
+cv::Point2i ExtractBayerY16toRGB(cv::Mat &dstRGB, cv::Mat &dstIR, uint8_t * src, int srcLen, cv::Point2i start,
+								 BayerCal *pCal, DefectMap *pDefects, FrameStats *pStats, FramePyramid *pPyramid)
+{
+	cv::Point2i p;
+	int depth = dstRGB.depth();
+	// stats of this band are gathered apart and merged once at the end
+	FrameStats part(pStats ? pStats->Range() : 1024);
+	FrameStats *pPart = pStats ? &part : NULL;
+	pCal = PrepareBand(dstRGB.cols, dstRGB.rows, src, srcLen, start, pCal, pDefects);
+	if (pPyramid && (start.y == 0) && (pPyramid->Begin(dstRGB, dstIR) != FramePyramid::OK))
+		pPyramid = NULL;
+	if (pPyramid && (pPyramid->Levels() < 2))
+		pPyramid = NULL;
+	switch (depth)
+	{
+	case 0:
+		p = ExtractBayerY16toRGB8(dstRGB,dstIR, src, srcLen, start, dstRGB.cols, 0, pCal, pPart, pPyramid);
+		break;
+	case 2:
+		p = ExtractBayerY16toRGB16(dstRGB,dstIR, src, srcLen, start, dstRGB.cols, 0, pCal, pPart, pPyramid);
+		break;
+	default:
+		break;
+	}
+	if (pStats)
+		pStats->Merge(part);
+	return p;
+}
+cv::Point2i ExtractBayerY16toYUV420(cv::Mat &dstYUV, cv::Mat &dstIR, YUV_LAYOUT layout, uint8_t * src, int srcLen, cv::Point2i start,
+									const TransferTable *pCurve, BayerCal *pCal, DefectMap *pDefects, FrameStats *pStats)
+{
+	int width = dstYUV.cols;
+	int height = dstYUV.rows * 2 / 3;
+	if ((dstYUV.type() != CV_8UC1) || !dstYUV.isContinuous() || (width & 1) || (height & 1) || (dstYUV.rows != height * 3 / 2)
+		|| (!dstIR.empty() && ((dstIR.type() != CV_8UC1) || (dstIR.cols != width) || (dstIR.rows != height))))
+	{
+		fprintf(stderr,"Error: YUV 4:2:0 extraction needs an 8 bit (height * 3 / 2) x width plane");
+		return cv::Point2i(0, dstYUV.rows);
+	}
+	if (pCurve == NULL)
+		pCurve = TransferTable::Get(TransferTable::CURVE_SRGB, 1024, 8);
+	FrameStats part(pStats ? pStats->Range() : 1024);
+	FrameStats *pPart = pStats ? &part : NULL;
+	pCal = PrepareBand(width, height, src, srcLen, start, pCal, pDefects);
+	cv::Point2i p = ExtractBayerY16toYUV(dstYUV, dstIR, width, height, layout, src, srcLen, start, pCurve, pCal, pPart);
+	if (pStats)
+		pStats->Merge(part);
+	return p;
+}
+// Regions of a whole frame, each into its own compact planes, straight from the buffer
+int ExtractBayerY16toRGBROI(std::vector<cv::Mat> &dstRGB, std::vector<cv::Mat> &dstIR, const std::vector<cv::Rect> &rois,
+							int depth, uint8_t * src, int srcLen, int width, int height,
+							BayerCal *pCal, DefectMap *pDefects)
+{
+	int done = 0;
+	dstRGB.resize(rois.size());
+	dstIR.resize(rois.size());
+	if (((depth != CV_8U) && (depth != CV_16U)) || (srcLen < width * height * 2))
+	{
+		fprintf(stderr,"Error: Region extraction needs a whole frame to 8 or 16 bit planes");
+		return 0;
+	}
+	if (pCal && (!pCal->Enabled() || !pCal->Matches(width, height)))
+		pCal = NULL;
+	bool patch = pDefects && pDefects->Matches(width, height);
+	for (size_t r = 0; r < rois.size(); r++)
+	{
+		const cv::Rect &roi = rois[r];
+		if ((roi.x & 1) || (roi.y & 1) || (roi.width & 1) || (roi.height & 1) || (roi.width <= 0) || (roi.height <= 0)
+			|| (roi.x < 0) || (roi.y < 0) || (roi.x + roi.width > width) || (roi.y + roi.height > height))
+		{
+			fprintf(stderr,"Error: Region %d,%d %dx%d is not on the 2x2 cells of the frame", roi.x, roi.y, roi.width, roi.height);
+			dstRGB[r].release();
+			dstIR[r].release();
+			continue;
+		}
+		// only the rows of the region, other regions on them are patched alike
+		if (patch)
+			pDefects->Correct((unsigned short *)src, roi.y, roi.y + roi.height);
+		dstRGB[r].create(roi.height, roi.width, CV_MAKETYPE(depth, 3));
+		dstIR[r].create(roi.height, roi.width, CV_MAKETYPE(depth, 1));
+		// the kernels step the region with the frame width as the source stride
+		if (depth == CV_8U)
+			ExtractBayerY16toRGB8(dstRGB[r], dstIR[r], src, roi.area() * 2, cv::Point2i(0, 0), width,
+								  roi.y * width + roi.x, pCal, NULL, NULL);
+		else
+			ExtractBayerY16toRGB16(dstRGB[r], dstIR[r], src, roi.area() * 2, cv::Point2i(0, 0), width,
+								   roi.y * width + roi.x, pCal, NULL, NULL);
+		done++;
+	}
+	return done;
+}
+// Binned extraction of a whole frame, bin x bin cells of each channel per output pixel
+// The rows of a bin are summed in 16 bit accumulators first, a plain add of contiguous
+// rows the compiler vectorizes, then each bin adds up its bin samples of each channel
+bool ExtractBayerY16toRGBBinned(cv::Mat &dstRGB, cv::Mat &dstIR, int bin, BIN_MODE mode, uint8_t * src, int srcLen,
+								int width, int height, BayerCal *pCal, DefectMap *pDefects, FrameStats *pStats)
+{
+	int cols = width / (2 * bin);
+	int rows = height / (2 * bin);
+	bool fill = (dstRGB.cols == width) && (dstRGB.rows == height);
+	if (((bin != 2) && (bin != 4)) || (cols < 1) || (rows < 1) || (srcLen < width * height * 2))
+	{
+		fprintf(stderr,"Error: Binning %dx%d needs a whole frame", bin, bin);
+		return false;
+	}
+	if (!fill)
+	{
+		dstRGB.create(rows, cols, CV_16UC3);
+		dstIR.create(rows, cols, CV_16UC1);
+	}
+	if ((dstRGB.type() != CV_16UC3) || (dstIR.type() != CV_16UC1) || (dstIR.size() != dstRGB.size()))
+	{
+		fprintf(stderr,"Error: Binning needs 16 bit RGB and IR planes");
+		return false;
+	}
+	FrameStats part(pStats ? pStats->Range() : 1024);
+	pCal = PrepareBand(width, height, src, srcLen, cv::Point2i(0,0), pCal, pDefects);
+	int shift = (bin == 2) ? 2 : 4;	// log2 of the samples in a bin
+	int top = (mode == BIN_SUM) ? (1023 << shift) : 1023;
+	int used = cols * 2 * bin;		// pixels of a row that are binned
+	float gainB = IRGain[0], gainG = IRGain[1], gainR = IRGain[2];
+	// corrected sites are held to 12 bits so 16 of them fit the 16 bit sums
+	std::vector<unsigned short> acc(2 * used);
+	unsigned short *pTop = &acc[0];			// B G rows
+	unsigned short *pBottom = pTop + used;	// IR R rows
+	// largest raw site of each column of the bin, clipping is judged on the raw sites
+	std::vector<unsigned short> peak(pStats ? 2 * used : 0);
+	unsigned short *pTopPeak = pStats ? &peak[0] : NULL;
+	unsigned short *pBottomPeak = pTopPeak + (pStats ? used : 0);
+	int pB, pG, pIR, pR;
+	unsigned short *pSrc = (unsigned short*) src;
+	unsigned short *pRowRGB, *pRowIR;
+	int sB, sG, sIR, sR, b, g, r, ir;
+	int by, bx, k, j, c, y, v;
+	for (by = 0; by < rows; by++)
+	{
+		memset(pTop, 0, 2 * used * sizeof(unsigned short));
+		if (pStats)
+			memset(pTopPeak, 0, 2 * used * sizeof(unsigned short));
+		for (k = 0; k < bin; k++)
+		{
+			y = 2 * (by * bin + k);
+			const unsigned short *p0 = pSrc + (size_t)y * width;
+			const unsigned short *p1 = p0 + width;
+			if (pStats)
+			{
+				for (j = 0; j < used; j++)
+					pTopPeak[j] = (p0[j] > pTopPeak[j]) ? p0[j] : pTopPeak[j];
+				for (j = 0; j < used; j++)
+					pBottomPeak[j] = (p1[j] > pBottomPeak[j]) ? p1[j] : pBottomPeak[j];
+			}
+			if (pCal)
+			{
+				for (j = 0; j < used; j++)
+				{
+					v = pCal->Correct(p0[j], y * width + j);
+					pTop[j] += (v < 4095) ? v : 4095;
+					v = pCal->Correct(p1[j], (y + 1) * width + j);
+					pBottom[j] += (v < 4095) ? v : 4095;
+				}
+			}
+			else
+			{
+				for (j = 0; j < used; j++)
+					pTop[j] += p0[j];
+				for (j = 0; j < used; j++)
+					pBottom[j] += p1[j];
+			}
+		}
+		y = fill ? 2 * bin * by : by;
+		pRowRGB = (unsigned short*)dstRGB.ptr(y);
+		pRowIR = (unsigned short*)dstIR.ptr(y);
+		for (bx = 0; bx < cols; bx++)
+		{
+			sB = sG = sIR = sR = 0;
+			for (c = 2 * bin * bx; c < 2 * bin * (bx + 1); c += 2)
+			{
+				sB += pTop[c]; sG += pTop[c + 1];
+				sIR += pBottom[c]; sR += pBottom[c + 1];
+			}
+			if (pStats)
+			{
+				// a bin is clipped when any of its sites is
+				pB = pG = pIR = pR = 0;
+				for (c = 2 * bin * bx; c < 2 * bin * (bx + 1); c += 2)
+				{
+					pB = (pTopPeak[c] > pB) ? pTopPeak[c] : pB;
+					pG = (pTopPeak[c + 1] > pG) ? pTopPeak[c + 1] : pG;
+					pIR = (pBottomPeak[c] > pIR) ? pBottomPeak[c] : pIR;
+					pR = (pBottomPeak[c + 1] > pR) ? pBottomPeak[c + 1] : pR;
+				}
+				part.AddCell(sB >> shift, sG >> shift, sIR >> shift, sR >> shift, pB, pG, pIR, pR);
+			}
+			// as ExtractBayerY16toRGB16() does for a cell, on the sums
+			b = 2 * (sB - (int)(gainB * sIR));
+			g = 2 * (sG - (int)(gainG * sIR));
+			r = 2 * (sR - (int)(gainR * sIR));
+			ir = 2 * sIR;
+			if (mode == BIN_AVERAGE)
+			{
+				b >>= shift; g >>= shift; r >>= shift; ir >>= shift;
+			}
+			b = (b < 0) ? 0 : ((b > top) ? top : b);
+			g = (g < 0) ? 0 : ((g > top) ? top : g);
+			r = (r < 0) ? 0 : ((r > top) ? top : r);
+			ir = (ir > top) ? top : ir;
+			if (fill)
+			{
+				for (j = 2 * bin * bx; j < 2 * bin * (bx + 1); j++)
+				{
+					pRowRGB[3 * j] = b; pRowRGB[3 * j + 1] = g; pRowRGB[3 * j + 2] = r;
+					pRowIR[j] = ir;
+				}
+			}
+			else
+			{
+				pRowRGB[3 * bx] = b; pRowRGB[3 * bx + 1] = g; pRowRGB[3 * bx + 2] = r;
+				pRowIR[bx] = ir;
+			}
+		}
+		if (fill)
+		{
+			// the rest of the rows the bins cover, and the columns past the last bin
+			for (j = used; j < width; j++)
+			{
+				pRowRGB[3 * j] = pRowRGB[3 * j + 1] = pRowRGB[3 * j + 2] = 0;
+				pRowIR[j] = 0;
+			}
+			for (k = 1; k < 2 * bin; k++)
+			{
+				memcpy(dstRGB.ptr(y + k), pRowRGB, width * 3 * sizeof(unsigned short));
+				memcpy(dstIR.ptr(y + k), pRowIR, width * sizeof(unsigned short));
+			}
+		}
+	}
+	// rows past the last bin
+	for (y = fill ? 2 * bin * rows : dstRGB.rows; y < dstRGB.rows; y++)
+	{
+		memset(dstRGB.ptr(y), 0, width * 3 * sizeof(unsigned short));
+		memset(dstIR.ptr(y), 0, width * sizeof(unsigned short));
+	}
+	if (pStats)
+		pStats->Merge(part);
+	return true;
+}
@@ -0,0 +1,196 @@
+#include "busreader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+BusReader::BusReader()
+{
+	m_pMap = NULL;
+	m_Size = 0;
+	m_pHeader = NULL;
+	m_Next = 0;
+	m_Overruns = 0;
+}
+BusReader::~BusReader()
+{
+	Close();
+}
+BusReader::ERR BusReader::Open(std::string name)
+{
+	Close();
+	m_Name = (name[0] == '/') ? name : "/" + name;
+	int fd = shm_open(m_Name.data(), O_RDONLY, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr,"Error: No frame bus %s", m_Name.data());
+		return FAIL;
+	}
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || (st.st_size < BUS_HEADER_BYTES))
+	{
+		fprintf(stderr,"Error: Frame bus %s is not ready", m_Name.data());
+		close(fd);
+		return FAIL;
+	}
+	void *pMap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (pMap == MAP_FAILED)
+	{
+		fprintf(stderr,"Error: Mapping frame bus %s", m_Name.data());
+		return FAIL;
+	}
+	m_pMap = (const uint8_t *)pMap;
+	m_Size = st.st_size;
+	const BUS_HEADER *pHeader = (const BUS_HEADER *)m_pMap;
+	if ((memcmp(pHeader->magic, BUS_MAGIC, 4) != 0) || (pHeader->version != BUS_VERSION)
+		|| ((size_t)pHeader->headerBytes + (size_t)pHeader->slots * pHeader->slotBytes > m_Size))
+	{
+		fprintf(stderr,"Error: %s is not a frame bus", m_Name.data());
+		munmap((void *)m_pMap, m_Size);
+		m_pMap = NULL;
+		return FAIL;
+	}
+	__sync_synchronize();
+	m_pHeader = pHeader;
+	m_Next = m_pHeader->published;	// from the next frame on
+	m_Overruns = 0;
+	return OK;
+}
+void BusReader::Close()
+{
+	if (m_pMap)
+		munmap((void *)m_pMap, m_Size);
+	m_pMap = NULL;
+	m_pHeader = NULL;
+	m_Size = 0;
+}
+bool BusReader::Alive()
+{
+	if ((m_pHeader == NULL) || m_pHeader->closed)
+		return false;
+	// a publisher that died without closing leaves the bus behind
+	return (kill(m_pHeader->pid, 0) == 0) || (errno == EPERM);
+}
+BusReader::ERR BusReader::Next(BUS_FRAME &frame, int timeoutMs)
+{
+	if (m_pHeader == NULL)
+		return FAIL;
+	while (true)
+	{
+		if (Wait(m_Next, timeoutMs) != OK)
+			return FAIL;
+		// the slot of the newest frame + 1 is the one being written next
+		uint32_t newest = m_pHeader->published - 1;
+		int32_t behind = (int32_t)(newest - m_Next);
+		if (behind >= (int32_t)m_pHeader->slots - 1)
+		{
+			m_Overruns += behind;
+			m_Next = newest;
+		}
+		if (Take(m_Next, frame) == OK)
+		{
+			m_Next++;
+			return OK;
+		}
+		m_Overruns++;	// lapped while taking it, try again from the newest
+		m_Next = m_pHeader->published - 1;
+	}
+}
+bool BusReader::Valid(const BUS_FRAME &frame)
+{
+	__sync_synchronize();
+	return frame.pSlot && (frame.pSlot->lock == frame.lock);
+}
+cv::Mat BusReader::Plane(const BUS_FRAME &frame, int plane)
+{
+	if ((plane < 0) || (plane >= BUS_PLANES) || (frame.pPlane[plane] == NULL))
+		return cv::Mat();
+	// the mapping is read only, the const is only cast away for the header
+	int level = BUS_PLANE_LEVEL(plane);
+	return cv::Mat(m_pHeader->height >> level, m_pHeader->width >> level, m_pHeader->planeType[plane], (void *)frame.pPlane[plane]);
+}
+BusReader::ERR BusReader::Copy(const BUS_FRAME &frame, int plane, cv::Mat &dst)
+{
+	cv::Mat src = Plane(frame, plane);
+	if (src.empty())
+		return FAIL;
+	src.copyTo(dst);
+	if (!Valid(frame))
+	{
+		m_Overruns++;
+		return OVERRUN;
+	}
+	return OK;
+}
+
+// ************************************************************************
+// ***************  Private Methods for BusReader  ************************
+// ************************************************************************
+BusReader::ERR BusReader::Wait(uint32_t frame, int timeoutMs)
+{
+	struct timespec end, now, left;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeoutMs / 1000;
+	end.tv_nsec += (timeoutMs % 1000) * 1000000L;
+	if (end.tv_nsec >= 1000000000L)
+	{
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+	uint32_t published;
+	while ((int32_t)((published = m_pHeader->published) - frame) <= 0)
+	{
+		if (m_pHeader->closed)
+			return FAIL;
+		if (timeoutMs < 0)
+		{
+			syscall(SYS_futex, &m_pHeader->published, FUTEX_WAIT, published, NULL, NULL, 0);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left.tv_sec = end.tv_sec - now.tv_sec;
+		left.tv_nsec = end.tv_nsec - now.tv_nsec;
+		if (left.tv_nsec < 0)
+		{
+			left.tv_sec--;
+			left.tv_nsec += 1000000000L;
+		}
+		if (left.tv_sec < 0)
+			return FAIL;
+		// returns at once if a frame came since published was read
+		syscall(SYS_futex, &m_pHeader->published, FUTEX_WAIT, published, &left, NULL, 0);
+	}
+	return OK;
+}
+BusReader::ERR BusReader::Take(uint32_t frame, BUS_FRAME &out)
+{
+	const BUS_SLOT *pSlot = (const BUS_SLOT *)(m_pMap + m_pHeader->headerBytes
+						   + (size_t)(frame % m_pHeader->slots) * m_pHeader->slotBytes);
+	uint32_t lock = pSlot->lock;
+	__sync_synchronize();
+	if ((lock & 1) || (pSlot->frame != frame))
+		return FAIL;
+	out.frame = frame;
+	out.sequence = pSlot->sequence;
+	out.exposure = pSlot->exposure;
+	out.sharpness[0] = pSlot->sharpness[0];
+	out.sharpness[1] = pSlot->sharpness[1];
+	out.timestamp.tv_sec = (time_t)pSlot->seconds;
+	out.timestamp.tv_usec = (suseconds_t)pSlot->microseconds;
+	for (int p = 0; p < BUS_PLANES; p++)
+	{
+		out.bytes[p] = pSlot->bytes[p];
+		out.pPlane[p] = out.bytes[p] ? (const uint8_t *)pSlot + m_pHeader->planeOffset[p] : NULL;
+	}
+	out.lock = lock;
+	out.pSlot = pSlot;
+	// the fields above are only good if nobody started on the slot meanwhile
+	return Valid(out) ? OK : FAIL;
+}
@@ -1,45 +1,36 @@
 #include "camerav4l2.h"
 
-// storage for static arrays
-unsigned char CameraV4L2::sRGBVal8[1024];
-unsigned short CameraV4L2::sRGBVal16[1024];
-
-#define CLIP8(x) ((x) < 0 ? 0 : ((x) >= 255 ? 255 : (x)))
-#define CLIP16(x) ((x) < 0 ? 0 : ((x) >= 65535 ? 65535 : (x)))
+#define SQRT_HALF 0.707106781F
+#define SRGB_STRIP_ROWS 32
 
 CameraV4L2::CameraV4L2(std::string device, int inputRange)
 {
 //	m_caps = {};
 //    m_fmt = {0};
-	float IRange = (float)inputRange;
 	m_DeviceName = device;
 	m_Width = 672; m_Height = 380;
 	m_fd = open(device.data(), O_RDWR);
 	if(m_fd <= 0)
 		fprintf(stderr,"Error: Unable to open Device");
-	// fill the sRGB arrays
-	float fI;
-	float a = 0.055F;
-	float recipGamma = 1.0F / 2.4F;
-	float rangeVal;
-	unsigned short SVal;
-	unsigned char  CVal;
-	for (int i = 0; i < 1024; i++)
+	m_Exposure = -1;
+	m_AEEnabled = false;
+	m_AEMeter = AE_LUMA;
+	m_AETarget = AE_TARGET;
+	m_AEInterval = AE_INTERVAL;
+	m_AEWait = 0;
+	m_AEExposure = 0;
+	m_AEMin = 1; m_AEMax = 10000;
+	m_AEConverged = true;
+	m_AEStart = 0.0;
+	m_AEConvergence = 0.0F;
+	// sRGB tables: 8 bit planes use all 256 codes, 16 bit planes the declared input range
+	m_InputRange = inputRange;
+	m_pSRGB8 = TransferTable::Get(TransferTable::CURVE_SRGB, 256, 8);
+	m_pSRGB16 = TransferTable::Get(TransferTable::CURVE_SRGB, inputRange, 16);
+	if (m_pSRGB16 == NULL)
 	{
-		fI = (float)i / IRange;
-		if (fI < 0.0031308F)
-		{
-			rangeVal = 12.92F * fI;
-		}
-		else
-		{
-			rangeVal = ((1.0 - a) * pow(fI, recipGamma) - a);
-		}
-		// saturate table values just in case
-		SVal = (unsigned short)CLIP16((int)(65536 * rangeVal));
-		CVal = (unsigned char)CLIP8((int)(256 * rangeVal));
-		sRGBVal16[i] = SVal;
-		sRGBVal8[i] = CVal;
+		m_InputRange = 1024;
+		m_pSRGB16 = TransferTable::Get(TransferTable::CURVE_SRGB, m_InputRange, 16);
 	}
 }
 CameraV4L2::~CameraV4L2()
@@ -51,6 +42,15 @@ bool CameraV4L2::Exists()
 {
 	return (m_fd > 0);
 }
+std::string CameraV4L2::BusInfo()
+{
+	if (-1 == xioctl(VIDIOC_QUERYCAP, &m_Caps))
+	{
+		fprintf(stderr,"Error: Querying Capabilities");
+		return std::string("unknown");
+	}
+	return std::string((char *)m_Caps.bus_info);
+}
 CameraV4L2::ERR CameraV4L2::SetSize(int width, int height)
 {
 	m_Width = width;
@@ -83,6 +83,7 @@ int CameraV4L2::GetExposure()	// in 1/10 ms
         fprintf(stderr,"Error: Getting Exposure");
 	    return -1;
     }
+	m_Exposure = c.value;
     return c.value;
 }
 CameraV4L2::ERR CameraV4L2::SetExposure(int tenth_ms)
@@ -97,8 +98,112 @@ CameraV4L2::ERR CameraV4L2::SetExposure(int tenth_ms)
     }
 	else
 		fprintf(stderr,"Set Exposure %6.1f ms\n",(float)c.value/10.0);
+	m_Exposure = c.value;
     return OK;
 }
+CameraV4L2::ERR CameraV4L2::SetAutoExposure(bool enable, float target, int interval, AE_METER meter)
+{
+	m_AETarget = ClampAETarget(target);
+	m_AEInterval = (interval < 1) ? 1 : interval;
+	m_AEMeter = meter;
+	if (!enable)
+	{
+		m_AEEnabled = false;
+		return OK;
+	}
+	// start from where manual exposure left it, within what the driver allows
+	m_AEExposure = GetExposure();
+	if (m_AEExposure < 0)
+		return FAIL;
+	struct v4l2_queryctrl q = {0};
+	q.id = 10094850;	// exposure
+	if (0 == xioctl(VIDIOC_QUERYCTRL, &q))
+	{
+		m_AEMin = (q.minimum > 0) ? q.minimum : 1;
+		m_AEMax = q.maximum;
+	}
+	m_AEWait = 0;
+	m_AEConverged = true;
+	m_AEEnabled = true;
+	return OK;
+}
+CameraV4L2::ERR CameraV4L2::UpdateAutoExposure(FrameStats &stats)
+{
+	if (!m_AEEnabled)
+		return OK;
+	// an update takes a few frames to show, wait for it or we oscillate
+	if (m_AEWait > 0)
+	{
+		m_AEWait--;
+		return OK;
+	}
+	float level, clipped;
+	if (m_AEMeter == AE_IR)
+	{
+		level = stats.Mean(FrameStats::FS_IR);
+		clipped = stats.ClippedFraction(FrameStats::FS_IR);
+	}
+	else
+	{
+		level = stats.Luma();
+		clipped = stats.ClippedFraction(FrameStats::FS_G);
+	}
+	level /= stats.Range();
+	double now = m_buf.timestamp.tv_sec + m_buf.timestamp.tv_usec * 1e-6;
+	float error = (level > 0.0F) ? m_AETarget / level : 4.0F;
+	bool inside = (error > 1.0F - AE_TOLERANCE) && (error < 1.0F + AE_TOLERANCE) && (clipped < AE_CLIP_LIMIT);
+	if (inside)
+	{
+		if (!m_AEConverged)
+		{
+			m_AEConvergence = (float)(now - m_AEStart);
+			m_AEConverged = true;
+		}
+		return OK;
+	}
+	if (m_AEConverged)
+	{
+		m_AEStart = now;
+		m_AEConverged = false;
+	}
+	// at most a stop per update and only part of the way there,
+	// the rest is picked up once this update has taken effect
+	if (clipped >= AE_CLIP_LIMIT)
+		error = (error < SQRT_HALF) ? error : SQRT_HALF;
+	error = (error > 2.0F) ? 2.0F : ((error < 0.5F) ? 0.5F : error);
+	float step = (float)pow(error, 0.7);
+	int exposure = (int)(m_AEExposure * step + 0.5F);
+	if (exposure == m_AEExposure)
+		exposure += (step > 1.0F) ? 1 : -1;
+	exposure = (exposure < m_AEMin) ? m_AEMin : ((exposure > m_AEMax) ? m_AEMax : exposure);
+	if (exposure == m_AEExposure)
+		return OK;	// pinned at a limit
+	struct v4l2_control c;
+	c.id = 10094850;	// exposure
+	c.value = exposure;
+	if (-1 == xioctl(VIDIOC_S_CTRL, &c))
+	{
+		fprintf(stderr,"Error: Setting Exposure");
+		return FAIL;
+	}
+	m_AEExposure = exposure;
+	m_Exposure = exposure;
+	m_AEWait = m_AEInterval;
+	return OK;
+}
+CameraV4L2::ERR CameraV4L2::UpdateAutoExposure(uint8_t *src, int srcLen)
+{
+	if (!m_AEEnabled)
+		return OK;
+	if (m_AEWait > 0)
+	{
+		m_AEWait--;
+		return OK;
+	}
+	FrameStats stats;
+	stats.SampleY16(src, srcLen, m_Fmt.fmt.pix.width, m_Fmt.fmt.pix.height);
+	return UpdateAutoExposure(stats);
+}
 int CameraV4L2::GetBrightness()	// in ms
 {
     struct v4l2_control c;
@@ -252,6 +357,9 @@ CameraV4L2::ERR CameraV4L2::Start()
         fprintf(stderr,"Error: Start Capture");
         return FAIL;
     }
+	// Exposure() is stamped on every frame, start it from the driver
+	GetExposure();
+	return OK;
 }
 CameraV4L2::ERR CameraV4L2::Stop()
 {
@@ -263,60 +371,68 @@ CameraV4L2::ERR CameraV4L2::Stop()
         return FAIL;
     }
 }
+// one strip of rows of ConvertTosRGB() for the thread pool
+typedef struct
+{
+	const TransferTable *pTable;
+	cv::Mat *pSrc;
+	cv::Mat *pDst;
+	int rows;	// rows per strip
+} SRGB_JOB;
+static void ConvertStrip(void *arg, int part)
+{
+	SRGB_JOB *pJob = (SRGB_JOB *)arg;
+	int width = pJob->pSrc->cols * pJob->pSrc->channels();
+	int first = part * pJob->rows;
+	int end = first + pJob->rows;
+	end = (end < pJob->pSrc->rows) ? end : pJob->pSrc->rows;
+	for (int i = first; i < end; i++)
+	{
+		if (pJob->pSrc->depth() == CV_8U)
+			pJob->pTable->Apply(pJob->pSrc->ptr(i), pJob->pDst->ptr(i), width);
+		else
+			pJob->pTable->Apply((unsigned short *)pJob->pSrc->ptr(i), (unsigned short *)pJob->pDst->ptr(i), width);
+	}
+}
+// src and dst may be the same cv::Mat, which saves the second frame buffer
 CameraV4L2::ERR CameraV4L2::ConvertTosRGB(cv::Mat &src, cv::Mat &dst)
 {
-	dst.create(src.size(), src.type());
-	unsigned short *pSrcs,*pDsts;
-	unsigned char  *pSrcc,*pDstc;
-	int width  = src.cols;
-	int height = src.rows;
-	int i,j;
-
-	switch (src.type())
+	SRGB_JOB job;
+	if (src.empty())
+		return OK;	// nothing to convert
+	switch (src.depth())
 	{
-	case CV_8UC3:
-		for (i = 0; i < height; i++)
-		{
-			pSrcc = (unsigned char *)src.ptr(i);
-			pDstc = (unsigned char *)dst.ptr(i);
-			for(j=0; j<width*3; j++)
-				pDstc[j] = sRGBVal8[pSrcc[j]];
-		}
+	case CV_8U:
+		job.pTable = m_pSRGB8;
 		break;
-	case CV_16UC3:
-		for (i = 0; i < height; i++)
-		{
-			pSrcs = (unsigned short *)src.ptr(i);
-			pDsts = (unsigned short *)dst.ptr(i);
-			for (j = 0; j < width * 3; j++)
-			{
-				pDsts[j] = sRGBVal16[pSrcs[j]];
-			}
-		}
-		break;
-	case CV_8UC1:
-		for (i = 0; i < height; i++)
-		{
-			pSrcc = (unsigned char *)src.ptr(i);
-			pDstc = (unsigned char *)dst.ptr(i);
-			for(j=0; j<width; j++)
-				pDstc[j] = sRGBVal8[pSrcc[j]];
-		}
-		break;
-	case CV_16UC1:
-		for (i = 0; i < height; i++)
-		{
-			pSrcs = (unsigned short *)src.ptr(i);
-			pDsts = (unsigned short *)dst.ptr(i);
-			for (j = 0; j < width; j++)
-			{
-				pDsts[j] = sRGBVal16[pSrcs[j]];
-			}
-		}
+	case CV_16U:
+		job.pTable = m_pSRGB16;
 		break;
 	default:
-		break;
+		fprintf(stderr,"Error: sRGB conversion of this type not supported");
+		return FAIL;
+	}
+	if (&dst != &src)
+		dst.create(src.size(), src.type());
+	job.pSrc = &src;
+	job.pDst = &dst;
+	// strips of at least SRGB_STRIP_ROWS rows, a few per thread to even out the load
+	ThreadPool *pPool = ThreadPool::Shared();
+	int strips = src.rows / SRGB_STRIP_ROWS;
+	strips = (strips < 4 * pPool->Threads()) ? strips : 4 * pPool->Threads();
+	strips = (strips < 1) ? 1 : strips;
+	job.rows = (src.rows + strips - 1) / strips;
+	pPool->Run(ConvertStrip, &job, (src.rows + job.rows - 1) / job.rows);
+	return OK;
+}
+CameraV4L2::ERR CameraV4L2::ConvertTosRGB(std::vector<cv::Mat> &planes)
+{
+	for (size_t i = 0; i < planes.size(); i++)
+	{
+		if (!planes[i].empty() && (ConvertTosRGB(planes[i], planes[i]) != OK))
+			return FAIL;
 	}
+	return OK;
 }
 
 // ************************************************************************
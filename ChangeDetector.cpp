@@ -0,0 +1,73 @@
+#include "changedetector.h"
+
+ChangeDetector::ChangeDetector()
+{
+	m_Width = m_Height = 0;
+	m_Step = CHANGE_STEP;
+	m_Cols = m_Rows = 0;
+	m_Level = CHANGE_LEVEL;
+	m_Area = CHANGE_AREA;
+	m_KeepAlive = CHANGE_KEEPALIVE;
+	m_Changed = 0.0F;
+	m_Tested = m_Skipped = 0;
+	Reset();
+}
+ChangeDetector::ERR ChangeDetector::Setup(int width, int height, int step)
+{
+	if ((width < 2) || (height < 2) || (step < 2) || (step & 1))
+	{
+		fprintf(stderr,"Error: Change detection on %dx%d every %d pixels not supported", width, height, step);
+		return FAIL;
+	}
+	m_Width = width;
+	m_Height = height;
+	m_Step = step;
+	// samples start half a step in so they spread evenly over the frame
+	m_Cols = (width - step / 2 + step - 1) / step;
+	m_Rows = (height - step / 2 + step - 1) / step;
+	m_Reference.assign(m_Cols * m_Rows, 0);
+	m_Current.assign(m_Cols * m_Rows, 0);
+	m_Tested = m_Skipped = 0;
+	Reset();
+	return OK;
+}
+void ChangeDetector::Reset()
+{
+	m_Valid = false;
+	m_Unchanged = 0;
+}
+bool ChangeDetector::Test(const uint8_t *raw, int rawLen)
+{
+	if (!Ready() || (raw == NULL) || (rawLen < m_Width * m_Height * 2))
+		return true;	// nothing to go on
+	const unsigned short *pSrc = (const unsigned short *)raw;
+	unsigned short *pCur = &m_Current[0];
+	const unsigned short *pRef = &m_Reference[0];
+	int x, y, i = 0;
+	int moved = 0;
+	int d;
+	for (y = m_Step / 2; y < m_Height; y += m_Step)
+	{
+		const unsigned short *p0 = pSrc + (size_t)(y & ~1) * m_Width;
+		const unsigned short *p1 = p0 + m_Width;
+		for (x = m_Step / 2; x < m_Width; x += m_Step, i++)
+		{
+			int cx = x & ~1;
+			pCur[i] = (unsigned short)(p0[cx] + p0[cx + 1] + p1[cx] + p1[cx + 1]);
+			d = pCur[i] - pRef[i];
+			moved += ((d > m_Level) || (d < -m_Level));
+		}
+	}
+	m_Tested++;
+	m_Changed = (float)moved / (m_Cols * m_Rows);
+	if (m_Valid && (m_Changed <= m_Area) && ((m_KeepAlive <= 0) || (m_Unchanged < m_KeepAlive)))
+	{
+		m_Unchanged++;
+		m_Skipped++;
+		return false;
+	}
+	m_Reference.swap(m_Current);
+	m_Valid = true;
+	m_Unchanged = 0;
+	return true;
+}
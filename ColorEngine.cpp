@@ -0,0 +1,168 @@
+#include "colorengine.h"
+#include "threadpool.h"
+#include <string.h>
+
+#define COLOR_STRIP_ROWS 16
+
+ColorEngine::ColorEngine()
+{
+	m_Enabled = false;
+	m_pCurve = NULL;
+	m_Size = 0;
+}
+ColorEngine::~ColorEngine()
+{
+}
+ColorEngine::ERR ColorEngine::SetCurve(const TransferTable *pCurve)
+{
+	if (pCurve && (pCurve->OutputBits() != 16))
+	{
+		fprintf(stderr,"Error: Color engine curve must have 16 bit output");
+		return FAIL;
+	}
+	m_pCurve = pCurve;
+	return OK;
+}
+ColorEngine::ERR ColorEngine::SetLUT(int n, const std::vector<float> &rgb)
+{
+	if ((n < 2) || (n > COLOR_LUT_MAX) || ((int)rgb.size() != 3 * n * n * n))
+	{
+		fprintf(stderr,"Error: 3D LUT of size %d not supported", n);
+		return FAIL;
+	}
+	m_Size = n;
+	m_Lattice.resize(3 * n * n * n);
+	int r, g, b, k, v;
+	for (int i = 0; i < n * n * n; i++)
+	{
+		// .cube order has red fastest, the lattice has blue fastest and stores B, G, R
+		r = i % n;
+		g = (i / n) % n;
+		b = i / (n * n);
+		for (k = 0; k < 3; k++)
+		{
+			v = (int)(rgb[3 * i + 2 - k] * 65535.0F + 0.5F);
+			m_Lattice[3 * ((r * n + g) * n + b) + k] = (unsigned short)((v < 0) ? 0 : ((v > 65535) ? 65535 : v));
+		}
+	}
+	return OK;
+}
+ColorEngine::ERR ColorEngine::LoadCube(std::string fileName)
+{
+	FILE *fp = fopen(fileName.data(), "r");
+	if (fp == NULL)
+		return FAIL;	// no grade for this camera
+	char line[256];
+	int n = 0;
+	float r, g, b;
+	std::vector<float> rgb;
+	while (fgets(line, sizeof(line), fp))
+	{
+		if ((line[0] == '#') || (line[0] == '\n') || (line[0] == '\r'))
+			continue;
+		if (strncmp(line, "LUT_3D_SIZE", 11) == 0)
+		{
+			sscanf(line + 11, "%d", &n);
+			if ((n >= 2) && (n <= COLOR_LUT_MAX))
+				rgb.reserve(3 * n * n * n);
+		}
+		else if (sscanf(line, "%f %f %f", &r, &g, &b) == 3)
+		{
+			rgb.push_back(r);
+			rgb.push_back(g);
+			rgb.push_back(b);
+		}
+		// TITLE, DOMAIN_MIN and DOMAIN_MAX are ignored, the domain is [0..1]
+	}
+	fclose(fp);
+	if (SetLUT(n, rgb) != OK)
+	{
+		fprintf(stderr,"Error: Reading %s", fileName.data());
+		return FAIL;
+	}
+	return OK;
+}
+
+// one strip of rows of Apply() for the thread pool
+typedef struct
+{
+	ColorEngine *pEngine;
+	cv::Mat *pSrc;
+	cv::Mat *pDst;
+	int rows;	// rows per strip
+	unsigned short *pRows;	// a row of scratch per strip
+} COLOR_JOB;
+static void ColorStrip(void *arg, int part)
+{
+	COLOR_JOB *pJob = (COLOR_JOB *)arg;
+	int first = part * pJob->rows;
+	int end = first + pJob->rows;
+	pJob->pEngine->ApplyRows(*pJob->pSrc, *pJob->pDst, first, (end < pJob->pSrc->rows) ? end : pJob->pSrc->rows,
+							 pJob->pRows + (size_t)part * pJob->pSrc->cols * 3);
+}
+ColorEngine::ERR ColorEngine::Apply(cv::Mat &src, cv::Mat &dst)
+{
+	if (!Enabled())
+		return FAIL;
+	if ((src.type() != CV_8UC3) && (src.type() != CV_16UC3))
+	{
+		fprintf(stderr,"Error: Color engine needs a 3 channel 8 or 16 bit plane");
+		return FAIL;
+	}
+	if (&dst != &src)
+		dst.create(src.size(), src.type());
+	COLOR_JOB job;
+	job.pEngine = this;
+	job.pSrc = &src;
+	job.pDst = &dst;
+	ThreadPool *pPool = ThreadPool::Shared();
+	int strips = src.rows / COLOR_STRIP_ROWS;
+	strips = (strips < 4 * pPool->Threads()) ? strips : 4 * pPool->Threads();
+	strips = (strips < 1) ? 1 : strips;
+	job.rows = (src.rows + strips - 1) / strips;
+	strips = (src.rows + job.rows - 1) / job.rows;
+	// the scratch rows are kept, so frames of this size or smaller allocate nothing
+	size_t scratch = (size_t)strips * src.cols * 3;
+	if (m_Rows.size() < scratch)
+		m_Rows.resize(scratch);
+	job.pRows = &m_Rows[0];
+	pPool->Run(ColorStrip, &job, strips);
+	return OK;
+}
+void ColorEngine::ApplyRows(cv::Mat &src, cv::Mat &dst, int first, int end, unsigned short *pRow)
+{
+	int width = src.cols * 3;
+	bool is8 = (src.depth() == CV_8U);
+	int bgr[3];
+	int i, j, k;
+	for (i = first; i < end; i++)
+	{
+		// 1D curve for the whole row first, 16 bit rows take the vector path
+		if (is8)
+		{
+			unsigned char *pSrc = src.ptr(i);
+			for (j = 0; j < width; j++)
+				pRow[j] = (unsigned short)m_pCurve->Lookup(pSrc[j]);
+		}
+		else
+			m_pCurve->Apply((unsigned short *)src.ptr(i), pRow, width);
+		if (m_Size > 0)
+		{
+			for (j = 0; j < width; j += 3)
+			{
+				bgr[0] = pRow[j]; bgr[1] = pRow[j + 1]; bgr[2] = pRow[j + 2];
+				Lookup(bgr);
+				for (k = 0; k < 3; k++)
+					pRow[j + k] = (unsigned short)bgr[k];
+			}
+		}
+		if (is8)
+		{
+			unsigned char *pDst = dst.ptr(i);
+			for (j = 0; j < width; j++)
+				pDst[j] = (unsigned char)(pRow[j] >> 8);
+		}
+		else
+			memcpy(dst.ptr(i), pRow, width * sizeof(unsigned short));
+	}
+}
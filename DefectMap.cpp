@@ -0,0 +1,152 @@
+#include "defectmap.h"
+#include <algorithm>
+
+DefectMap::DefectMap()
+{
+	m_Width = 0; m_Height = 0;
+	m_AccumCount = 0;
+}
+DefectMap::~DefectMap()
+{
+}
+DefectMap::ERR DefectMap::SetSize(int width, int height)
+{
+	if ((width <= 0) || (height <= 0) || (width & 1) || (height & 1))
+	{
+		fprintf(stderr,"Error: Defect map size must be even");
+		return FAIL;
+	}
+	m_Width = width;
+	m_Height = height;
+	m_Sites.clear();
+	m_Accum.clear();
+	m_AccumCount = 0;
+	return OK;
+}
+DefectMap::ERR DefectMap::Add(int x, int y)
+{
+	if ((x < 0) || (x >= m_Width) || (y < 0) || (y >= m_Height))
+		return FAIL;
+	uint32_t site = (uint32_t)(x + m_Width * y);
+	std::vector<uint32_t>::iterator it = std::lower_bound(m_Sites.begin(), m_Sites.end(), site);
+	if ((it == m_Sites.end()) || (*it != site))
+		m_Sites.insert(it, site);
+	return OK;
+}
+bool DefectMap::IsDefect(int x, int y)
+{
+	uint32_t site = (uint32_t)(x + m_Width * y);
+	return std::binary_search(m_Sites.begin(), m_Sites.end(), site);
+}
+void DefectMap::BeginLearn()
+{
+	m_Accum.assign(m_Width * m_Height, 0);
+	m_AccumCount = 0;
+}
+DefectMap::ERR DefectMap::AddLearn(uint8_t *src, int srcLen)
+{
+	int n = m_Width * m_Height;
+	if ((src == NULL) || (srcLen < (int)(n * sizeof(unsigned short))) || ((int)m_Accum.size() != n))
+	{
+		fprintf(stderr,"Error: Defect learn frame does not match");
+		return FAIL;
+	}
+	unsigned short *pSrc = (unsigned short *)src;
+	uint32_t *pAcc = &m_Accum[0];
+	for (int i = 0; i < n; i++)
+		pAcc[i] += pSrc[i];
+	m_AccumCount++;
+	return OK;
+}
+DefectMap::ERR DefectMap::EndLearn(int threshold)
+{
+	if (m_AccumCount == 0)
+	{
+		fprintf(stderr,"Error: No Defect Learn Frames Captured");
+		return FAIL;
+	}
+	int x, y, c;
+	double sum[4] = {0.0, 0.0, 0.0, 0.0};
+	for (y = 0; y < m_Height; y++)
+		for (x = 0; x < m_Width; x++)
+			sum[((y & 1) << 1) | (x & 1)] += m_Accum[x + m_Width * y];
+	// limit in accumulated units: (channel mean + threshold) * frames
+	double limit[4];
+	for (c = 0; c < 4; c++)
+		limit[c] = sum[c] * 4.0 / (m_Width * m_Height) + (double)threshold * m_AccumCount;
+	m_Sites.clear();
+	for (y = 0; y < m_Height; y++)
+		for (x = 0; x < m_Width; x++)
+			if (m_Accum[x + m_Width * y] > limit[((y & 1) << 1) | (x & 1)])
+				m_Sites.push_back((uint32_t)(x + m_Width * y));	// already in order
+	m_Accum.clear();
+	m_AccumCount = 0;
+	fprintf(stderr,"Defect map: %d sites\n", Count());
+	return OK;
+}
+DefectMap::ERR DefectMap::Save(std::string fileName)
+{
+	FILE *fp = fopen(fileName.data(), "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr,"Error: Unable to write %s", fileName.data());
+		return FAIL;
+	}
+	fprintf(fp, "# defect map %dx%d\n", m_Width, m_Height);
+	for (size_t i = 0; i < m_Sites.size(); i++)
+		fprintf(fp, "%d %d\n", m_Sites[i] % m_Width, m_Sites[i] / m_Width);
+	fclose(fp);
+	return OK;
+}
+DefectMap::ERR DefectMap::Load(std::string fileName)
+{
+	FILE *fp = fopen(fileName.data(), "r");
+	if (fp == NULL)
+		return FAIL;	// no defect map for this camera yet
+	int width = 0, height = 0, x, y;
+	if ((fscanf(fp, "# defect map %dx%d", &width, &height) != 2) || (SetSize(width, height) != OK))
+	{
+		fprintf(stderr,"Error: Reading %s", fileName.data());
+		fclose(fp);
+		return FAIL;
+	}
+	while (fscanf(fp, "%d %d", &x, &y) == 2)
+		Add(x, y);
+	fclose(fp);
+	return OK;
+}
+void DefectMap::Correct(unsigned short *pSrc, int yStart, int yEnd)
+{
+	if (m_Sites.empty())
+		return;
+	// same channel neighbours are two sites away
+	static const int dx[8] = {-2, 2, 0, 0, -2, 2, -2, 2};
+	static const int dy[8] = {0, 0, -2, 2, -2, -2, 2, 2};
+	unsigned short v[8];
+	std::vector<uint32_t>::iterator it = std::lower_bound(m_Sites.begin(), m_Sites.end(), (uint32_t)(m_Width * yStart));
+	std::vector<uint32_t>::iterator end = std::lower_bound(it, m_Sites.end(), (uint32_t)(m_Width * yEnd));
+	int x, y, nx, ny, n, k, j;
+	unsigned short t;
+	for (; it != end; ++it)
+	{
+		x = *it % m_Width;
+		y = *it / m_Width;
+		n = 0;
+		for (k = 0; k < 8; k++)
+		{
+			nx = x + dx[k];
+			ny = y + dy[k];
+			if ((nx < 0) || (nx >= m_Width) || (ny < 0) || (ny >= m_Height) || IsDefect(nx, ny))
+				continue;
+			// insertion sort as we go, there are at most 8
+			t = pSrc[nx + m_Width * ny];
+			for (j = n; (j > 0) && (v[j - 1] > t); j--)
+				v[j] = v[j - 1];
+			v[j] = t;
+			n++;
+		}
+		if (n == 0)
+			continue;	// surrounded by defects, leave it
+		pSrc[*it] = (n & 1) ? v[n / 2] : (unsigned short)((v[n / 2 - 1] + v[n / 2] + 1) / 2);
+	}
+}
@@ -0,0 +1,111 @@
+#include "focusmeter.h"
+
+FocusMeter::FocusMeter()
+{
+	m_ROI = cv::Rect();
+	Reset();
+}
+void FocusMeter::Reset()
+{
+	for (int c = 0; c < FOCUS_CHANNELS; c++)
+	{
+		m_Sharpness[c] = -1.0F;
+		m_Average[c] = 0.0F;
+		m_Peak[c] = 0.0F;
+	}
+	m_Frames = 0;
+}
+FocusMeter::ERR FocusMeter::Measure(const cv::Mat &RGB, const cv::Mat &IR)
+{
+	if (((RGB.type() != CV_8UC3) && (RGB.type() != CV_16UC3)) || (IR.depth() != RGB.depth())
+		|| (IR.channels() != 1) || (IR.size() != RGB.size()))
+	{
+		fprintf(stderr,"Error: Focus needs 8 or 16 bit RGB and IR planes of the same size");
+		return FAIL;
+	}
+	cv::Rect frame(0, 0, RGB.cols, RGB.rows);
+	cv::Rect roi = (m_ROI.area() > 0) ? (m_ROI & frame) : cv::Rect(RGB.cols / 4, RGB.rows / 4, RGB.cols / 2, RGB.rows / 2);
+	// whole cells inside the region
+	cv::Rect cells((roi.x + 1) / 2, (roi.y + 1) / 2, 0, 0);
+	cells.width = (roi.x + roi.width) / 2 - cells.x;
+	cells.height = (roi.y + roi.height) / 2 - cells.y;
+	if ((cells.width < 3) || (cells.height < 3))
+	{
+		fprintf(stderr,"Error: Focus region must be at least 6x6 pixels");
+		return FAIL;
+	}
+	m_Sharpness[FOCUS_G] = Variance(RGB, 1, cells);
+	m_Sharpness[FOCUS_IR] = Variance(IR, 0, cells);
+	for (int c = 0; c < FOCUS_CHANNELS; c++)
+	{
+		if (m_Frames == 0)
+			m_Average[c] = m_Sharpness[c];
+		else
+			m_Average[c] += (m_Sharpness[c] - m_Average[c]) / FOCUS_AVERAGE;
+		// the average has settled once it has seen FOCUS_AVERAGE frames
+		if ((m_Frames >= FOCUS_AVERAGE) && (m_Average[c] > m_Peak[c]))
+			m_Peak[c] = m_Average[c];
+	}
+	m_Frames++;
+	return OK;
+}
+
+// ************************************************************************
+// ***************  Private Methods for FocusMeter  ***********************
+// ************************************************************************
+// Variance of the Laplacian of one channel on the cells, in 8 bit units
+float FocusMeter::Variance(const cv::Mat &src, int channel, cv::Rect cells)
+{
+	int n = cells.width;
+	int channels = src.channels();
+	int step = 2 * channels;	// from one cell to the next
+	bool is16 = (src.depth() == CV_16U);
+	m_Rows.resize(3 * n);
+	int64_t sum = 0;
+	uint64_t sum2 = 0;
+	int cy, j, k, end, l, s;
+	unsigned int s2;
+	for (cy = 0; cy < cells.height; cy++)
+	{
+		// top left pixel of each cell, rows of cells go round the three rows
+		short *pDst = &m_Rows[(cy % 3) * n];
+		int y = 2 * (cells.y + cy);
+		if (is16)
+		{
+			const unsigned short *pSrc = (const unsigned short *)src.ptr(y) + 2 * cells.x * channels + channel;
+			for (j = 0; j < n; j++)
+				pDst[j] = (short)pSrc[j * step];
+		}
+		else
+		{
+			const unsigned char *pSrc = src.ptr(y) + 2 * cells.x * channels + channel;
+			for (j = 0; j < n; j++)
+				pDst[j] = pSrc[j * step];
+		}
+		if (cy < 2)
+			continue;
+		const short *pUp = &m_Rows[((cy - 2) % 3) * n];
+		const short *pMid = &m_Rows[((cy - 1) % 3) * n];
+		const short *pDown = pDst;
+		// |l| <= 4 * 1023, so FOCUS_CHUNK squares fit 32 bits
+		for (j = 1; j < n - 1; j = end)
+		{
+			end = (j + FOCUS_CHUNK < n - 1) ? j + FOCUS_CHUNK : n - 1;
+			s = 0;
+			s2 = 0;
+			for (k = j; k < end; k++)
+			{
+				l = 4 * pMid[k] - pMid[k - 1] - pMid[k + 1] - pUp[k] - pDown[k];
+				s += l;
+				s2 += l * l;
+			}
+			sum += s;
+			sum2 += s2;
+		}
+	}
+	double count = (double)(n - 2) * (cells.height - 2);
+	double mean = sum / count;
+	double variance = sum2 / count - mean * mean;
+	// 16 bit planes hold 10 bit values
+	return (float)(is16 ? variance / 16.0 : variance);
+}
@@ -0,0 +1,173 @@
+#include "framebus.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+FrameBus::FrameBus()
+{
+	m_pMap = NULL;
+	m_Size = 0;
+	m_pHeader = NULL;
+}
+FrameBus::~FrameBus()
+{
+	Close();
+}
+FrameBus::ERR FrameBus::Create(std::string name, int width, int height, int planes, int depth, int slots)
+{
+	Close();
+	planes &= BUS_ALL | BUS_PYRAMID;
+	if ((width < 2) || (height < 2) || (slots < 2) || (planes == 0) || ((depth != CV_8U) && (depth != CV_16U)))
+	{
+		fprintf(stderr,"Error: Frame bus of %d %dx%d slots not supported", slots, width, height);
+		return FAIL;
+	}
+	m_Name = (name[0] == '/') ? name : "/" + name;
+	// slot layout, every plane on its own cache lines
+	uint32_t type[BUS_PLANES], offset[BUS_PLANES], bytes[BUS_PLANES];
+	size_t slotBytes = (sizeof(BUS_SLOT) + BUS_ALIGN - 1) & ~(size_t)(BUS_ALIGN - 1);
+	int p;
+	for (p = 0; p < BUS_PLANES; p++)
+	{
+		if ((planes & BUS_PLANE_BIT(p)) == 0)
+		{
+			type[p] = 0;
+			offset[p] = bytes[p] = 0;
+			continue;
+		}
+		// RGB and IR alternate from BUS_RGB on, over the frame and its levels
+		type[p] = (p == BUS_RAW) ? CV_16UC1 : CV_MAKETYPE(depth, ((p - BUS_RGB) & 1) ? 1 : 3);
+		offset[p] = (uint32_t)slotBytes;
+		bytes[p] = (uint32_t)((width >> BUS_PLANE_LEVEL(p)) * (height >> BUS_PLANE_LEVEL(p)) * CV_ELEM_SIZE(type[p]));
+		slotBytes += (bytes[p] + BUS_ALIGN - 1) & ~(size_t)(BUS_ALIGN - 1);
+	}
+	m_Size = BUS_HEADER_BYTES + slots * slotBytes;
+
+	// a bus left behind by a publisher that died is replaced, its readers keep the old one
+	shm_unlink(m_Name.data());
+	int fd = shm_open(m_Name.data(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+	{
+		fprintf(stderr,"Error: Creating frame bus %s", m_Name.data());
+		return FAIL;
+	}
+	if (ftruncate(fd, m_Size) != 0)
+	{
+		fprintf(stderr,"Error: Sizing frame bus %s to %lu bytes", m_Name.data(), (unsigned long)m_Size);
+		close(fd);
+		shm_unlink(m_Name.data());
+		return FAIL;
+	}
+	void *pMap = mmap(NULL, m_Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (pMap == MAP_FAILED)
+	{
+		fprintf(stderr,"Error: Mapping frame bus %s", m_Name.data());
+		shm_unlink(m_Name.data());
+		return FAIL;
+	}
+	m_pMap = (uint8_t *)pMap;
+	// the new object is zero filled, so every slot lock starts even and empty
+	m_pHeader = (BUS_HEADER *)m_pMap;
+	m_pHeader->version = BUS_VERSION;
+	m_pHeader->headerBytes = BUS_HEADER_BYTES;
+	m_pHeader->slots = slots;
+	m_pHeader->slotBytes = (uint32_t)slotBytes;
+	m_pHeader->width = width;
+	m_pHeader->height = height;
+	m_pHeader->planes = planes;
+	for (p = 0; p < BUS_PLANES; p++)
+	{
+		m_pHeader->planeType[p] = type[p];
+		m_pHeader->planeOffset[p] = offset[p];
+		m_pHeader->planeBytes[p] = bytes[p];
+	}
+	m_pHeader->pid = getpid();
+	m_pHeader->closed = 0;
+	m_pHeader->published = 0;
+	// the magic goes in last, a reader attaching now sees a complete header or none
+	__sync_synchronize();
+	memcpy(m_pHeader->magic, BUS_MAGIC, 4);
+	fprintf(stderr,"Frame bus %s, %d slots of %lu KB\n", m_Name.data(), slots, (unsigned long)(slotBytes >> 10));
+	return OK;
+}
+void FrameBus::Close()
+{
+	if (m_pHeader == NULL)
+		return;
+	m_pHeader->closed = 1;
+	__sync_synchronize();
+	syscall(SYS_futex, &m_pHeader->published, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	munmap(m_pMap, m_Size);
+	shm_unlink(m_Name.data());
+	m_pMap = NULL;
+	m_pHeader = NULL;
+	m_Size = 0;
+}
+FrameBus::ERR FrameBus::Publish(const uint8_t *raw, int rawLen, const cv::Mat &RGB, const cv::Mat &IR,
+								uint32_t sequence, struct timeval timestamp, int exposure, const float *sharpness,
+								FramePyramid *pPyramid)
+{
+	if (m_pHeader == NULL)
+		return FAIL;
+	uint32_t frame = m_pHeader->published;
+	BUS_SLOT *pSlot = (BUS_SLOT *)(m_pMap + m_pHeader->headerBytes + (size_t)(frame % m_pHeader->slots) * m_pHeader->slotBytes);
+	// odd while the slot is being written
+	pSlot->lock++;
+	__sync_synchronize();
+	pSlot->frame = frame;
+	pSlot->sequence = sequence;
+	pSlot->exposure = exposure;
+	pSlot->seconds = timestamp.tv_sec;
+	pSlot->microseconds = timestamp.tv_usec;
+	pSlot->sharpness[0] = sharpness ? sharpness[0] : -1.0F;
+	pSlot->sharpness[1] = sharpness ? sharpness[1] : -1.0F;
+	pSlot->bytes[BUS_RAW] = 0;
+	if (m_pHeader->planeType[BUS_RAW] && raw && (rawLen > 0))
+	{
+		pSlot->bytes[BUS_RAW] = ((uint32_t)rawLen < m_pHeader->planeBytes[BUS_RAW]) ? rawLen : m_pHeader->planeBytes[BUS_RAW];
+		memcpy((uint8_t *)pSlot + m_pHeader->planeOffset[BUS_RAW], raw, pSlot->bytes[BUS_RAW]);
+	}
+	PutPlane(pSlot, BUS_RGB, RGB);
+	PutPlane(pSlot, BUS_IR, IR);
+	// levels the pyramid did not build this frame are left out
+	cv::Mat none;
+	for (int level = 1, p = BUS_RGB_HALF; level < BUS_LEVELS; level++, p += 2)
+	{
+		bool built = pPyramid && (level < pPyramid->Levels());
+		PutPlane(pSlot, p, built ? pPyramid->LevelRGB(level) : none);
+		PutPlane(pSlot, p + 1, built ? pPyramid->LevelIR(level) : none);
+	}
+	__sync_synchronize();
+	pSlot->lock++;
+	__sync_synchronize();
+	m_pHeader->published = frame + 1;
+	syscall(SYS_futex, &m_pHeader->published, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	return OK;
+}
+
+// ************************************************************************
+// ***************  Private Methods for FrameBus  *************************
+// ************************************************************************
+void FrameBus::PutPlane(BUS_SLOT *pSlot, int plane, const cv::Mat &src)
+{
+	pSlot->bytes[plane] = 0;
+	int level = BUS_PLANE_LEVEL(plane);
+	if ((m_pHeader->planeType[plane] == 0) || ((uint32_t)src.type() != m_pHeader->planeType[plane])
+		|| ((uint32_t)src.cols != (m_pHeader->width >> level)) || ((uint32_t)src.rows != (m_pHeader->height >> level)))
+		return;
+	uint8_t *pDst = (uint8_t *)pSlot + m_pHeader->planeOffset[plane];
+	size_t rowBytes = src.cols * src.elemSize();
+	if (src.isContinuous())
+		memcpy(pDst, src.ptr(), rowBytes * src.rows);
+	else
+	{
+		for (int i = 0; i < src.rows; i++)
+			memcpy(pDst + i * rowBytes, src.ptr(i), rowBytes);
+	}
+	pSlot->bytes[plane] = m_pHeader->planeBytes[plane];
+}
@@ -0,0 +1,154 @@
+#include "framepyramid.h"
+#include <stdlib.h>
+
+#define ALIGNUP(n) (((n) + PYRAMID_ALIGN - 1) & ~(size_t)(PYRAMID_ALIGN - 1))
+
+FramePyramid::FramePyramid(int levels)
+{
+	m_Levels = 1;
+	m_Width = m_Height = m_Depth = 0;
+	m_Built = 0;
+	m_pBlock = NULL;
+	m_Bytes = 0;
+	SetLevels(levels);
+}
+FramePyramid::~FramePyramid()
+{
+	Free();
+}
+FramePyramid::ERR FramePyramid::SetLevels(int levels)
+{
+	if ((levels < 1) || (levels > PYRAMID_LEVELS_MAX))
+	{
+		fprintf(stderr,"Error: Pyramid of %d levels not supported", levels);
+		return FAIL;
+	}
+	m_Levels = levels;
+	return OK;
+}
+FramePyramid::ERR FramePyramid::Begin(cv::Mat &RGB, cv::Mat &IR)
+{
+	if (((RGB.type() != CV_8UC3) && (RGB.type() != CV_16UC3)) || (IR.depth() != RGB.depth())
+		|| (IR.channels() != 1) || (IR.size() != RGB.size()))
+	{
+		fprintf(stderr,"Error: Pyramid needs 8 or 16 bit RGB and IR planes of the same size");
+		m_Built = 0;
+		return FAIL;
+	}
+	m_RGB[0] = RGB;
+	m_IR[0] = IR;
+	if ((m_Built == 0) || (RGB.cols != m_Width) || (RGB.rows != m_Height) || (RGB.depth() != m_Depth)
+		|| (m_Built != LevelsFor(RGB.cols, RGB.rows)))
+		return Layout(RGB.cols, RGB.rows, RGB.depth());
+	return OK;
+}
+// Box filter the rows of the lower levels that row of level 1 completes
+void FramePyramid::EndRow(int row)
+{
+	for (int level = 2; level < m_Built; level++)
+	{
+		if ((row & 1) == 0)
+			break;	// the first of a pair
+		row >>= 1;
+		if (row >= m_RGB[level].rows)
+			break;	// odd row count, the last row of the level above is dropped
+		Reduce(level, row);
+	}
+}
+
+// ************************************************************************
+// ***************  Private Methods for FramePyramid  *********************
+// ************************************************************************
+// Levels that fit a frame, each at least one pixel
+int FramePyramid::LevelsFor(int width, int height)
+{
+	int levels = 1;
+	while ((levels < m_Levels) && ((width >> levels) > 0) && ((height >> levels) > 0))
+		levels++;
+	return levels;
+}
+FramePyramid::ERR FramePyramid::Layout(int width, int height, int depth)
+{
+	Free();
+	m_Width = width;
+	m_Height = height;
+	m_Depth = depth;
+	int built = LevelsFor(width, height);
+	size_t size = (depth == CV_16U) ? 2 : 1;
+	size_t rgbStep[PYRAMID_LEVELS_MAX], irStep[PYRAMID_LEVELS_MAX];
+	size_t bytes = 0;
+	int level;
+	for (level = 1; level < built; level++)
+	{
+		rgbStep[level] = ALIGNUP((width >> level) * 3 * size);
+		irStep[level] = ALIGNUP((width >> level) * size);
+		bytes += (height >> level) * (rgbStep[level] + irStep[level]);
+	}
+	if (bytes > 0)
+	{
+		void *pBlock;
+		if (posix_memalign(&pBlock, PYRAMID_ALIGN, bytes) != 0)
+		{
+			fprintf(stderr,"Error: Allocating %u bytes of pyramid", (unsigned int)bytes);
+			return FAIL;
+		}
+		m_pBlock = (unsigned char *)pBlock;
+	}
+	m_Bytes = bytes;
+	// all the RGB planes then all the IR planes, the finer levels first
+	unsigned char *p = m_pBlock;
+	for (level = 1; level < built; level++)
+	{
+		m_RGB[level] = cv::Mat(height >> level, width >> level, CV_MAKETYPE(depth, 3), p, rgbStep[level]);
+		p += (height >> level) * rgbStep[level];
+	}
+	for (level = 1; level < built; level++)
+	{
+		m_IR[level] = cv::Mat(height >> level, width >> level, CV_MAKETYPE(depth, 1), p, irStep[level]);
+		p += (height >> level) * irStep[level];
+	}
+	m_Built = built;
+	return OK;
+}
+// row of a level is the rounded mean of the 2x2 blocks of rows 2 * row and 2 * row + 1 above
+template <typename T> static void BoxRow(const T *pA, const T *pB, T *pDst, int cols, int channels)
+{
+	int stride = 2 * channels;
+	for (int x = 0; x < cols; x++)
+	{
+		for (int k = 0; k < channels; k++)
+			pDst[k] = (T)((pA[k] + pA[k + channels] + pB[k] + pB[k + channels] + 2) >> 2);
+		pA += stride;
+		pB += stride;
+		pDst += channels;
+	}
+}
+void FramePyramid::Reduce(int level, int row)
+{
+	cv::Mat &srcRGB = m_RGB[level - 1], &srcIR = m_IR[level - 1];
+	int cols = m_RGB[level].cols;
+	if (m_Depth == CV_16U)
+	{
+		BoxRow((unsigned short *)srcRGB.ptr(2 * row), (unsigned short *)srcRGB.ptr(2 * row + 1),
+			   (unsigned short *)m_RGB[level].ptr(row), cols, 3);
+		BoxRow((unsigned short *)srcIR.ptr(2 * row), (unsigned short *)srcIR.ptr(2 * row + 1),
+			   (unsigned short *)m_IR[level].ptr(row), cols, 1);
+	}
+	else
+	{
+		BoxRow(srcRGB.ptr(2 * row), srcRGB.ptr(2 * row + 1), m_RGB[level].ptr(row), cols, 3);
+		BoxRow(srcIR.ptr(2 * row), srcIR.ptr(2 * row + 1), m_IR[level].ptr(row), cols, 1);
+	}
+}
+void FramePyramid::Free()
+{
+	for (int level = 1; level < PYRAMID_LEVELS_MAX; level++)
+	{
+		m_RGB[level].release();
+		m_IR[level].release();
+	}
+	free(m_pBlock);
+	m_pBlock = NULL;
+	m_Bytes = 0;
+	m_Built = 0;
+}
@@ -0,0 +1,82 @@
+#include "framestats.h"
+
+FrameStats::FrameStats(int inputRange)
+{
+	SetRange(inputRange);
+}
+void FrameStats::Reset()
+{
+	memset(hist, 0, sizeof(hist));
+	memset(sum, 0, sizeof(sum));
+	memset(clipped, 0, sizeof(clipped));
+	memset(count, 0, sizeof(count));
+}
+void FrameStats::SetRange(int inputRange)
+{
+	m_Shift = 0;
+	while ((FRAMESTATS_BINS << (m_Shift + 1)) <= inputRange)
+		m_Shift++;
+	m_Range = FRAMESTATS_BINS << m_Shift;
+	m_Clip = m_Range - 1;
+	Reset();
+}
+void FrameStats::Merge(const FrameStats &other)
+{
+	for (int c = 0; c < FS_COUNT; c++)
+	{
+		for (int b = 0; b < FRAMESTATS_BINS; b++)
+			hist[c][b] += other.hist[c][b];
+		sum[c] += other.sum[c];
+		clipped[c] += other.clipped[c];
+		count[c] += other.count[c];
+	}
+}
+float FrameStats::Mean(int channel)
+{
+	if (count[channel] == 0)
+		return 0.0F;
+	return (float)((double)sum[channel] / count[channel]);
+}
+float FrameStats::ClippedFraction(int channel)
+{
+	if (count[channel] == 0)
+		return 0.0F;
+	return (float)clipped[channel] / count[channel];
+}
+int FrameStats::Percentile(int channel, float fraction)
+{
+	uint32_t target = (uint32_t)(fraction * count[channel]);
+	uint32_t n = 0;
+	for (int b = 0; b < FRAMESTATS_BINS; b++)
+	{
+		n += hist[channel][b];
+		if (n > target)
+			return (b + 1) << m_Shift;
+	}
+	return m_Range;
+}
+float FrameStats::Luma()
+{
+	return 0.114F * Mean(FS_B) + 0.587F * Mean(FS_G) + 0.299F * Mean(FS_R);
+}
+void FrameStats::SampleY16(uint8_t *src, int srcLen, int width, int height, int step)
+{
+	Reset();
+	unsigned short *pSrc = (unsigned short *)src;
+	step = (step + 1) & ~1;
+	if ((src == NULL) || (step <= 0))
+		return;
+	// only whole row pairs that are in the buffer
+	int rows = srcLen / (int)(width * sizeof(unsigned short));
+	if (rows > height)
+		rows = height;
+	int x, y, i;
+	for (y = 0; y + 1 < rows; y += step)
+	{
+		for (x = 0; x + 1 < width; x += step)
+		{
+			i = x + width * y;
+			AddCell(pSrc[i], pSrc[i + 1], pSrc[i + width], pSrc[i + width + 1]);
+		}
+	}
+}
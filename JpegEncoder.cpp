@@ -0,0 +1,467 @@
+#include "jpegencoder.h"
+#include <string.h>
+
+// natural index of each zigzag position
+static const unsigned char s_Zigzag[64] =
+{
+	 0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+// ITU T.81 Annex K quantisation tables for quality 50, natural order
+static const unsigned char s_BaseQuant[2][64] =
+{
+	{
+		16, 11, 10, 16,  24,  40,  51,  61,  12, 12, 14, 19,  26,  58,  60,  55,
+		14, 13, 16, 24,  40,  57,  69,  56,  14, 17, 22, 29,  51,  87,  80,  62,
+		18, 22, 37, 56,  68, 109, 103,  77,  24, 35, 55, 64,  81, 104, 113,  92,
+		49, 64, 78, 87, 103, 121, 120, 101,  72, 92, 95, 98, 112, 100, 103,  99
+	},
+	{
+		17, 18, 24, 47, 99, 99, 99, 99,  18, 21, 26, 66, 99, 99, 99, 99,
+		24, 26, 56, 99, 99, 99, 99, 99,  47, 66, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99,  99, 99, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99,  99, 99, 99, 99, 99, 99, 99, 99
+	}
+};
+// Annex K Huffman tables: code counts per length 1..16, then the symbols
+static const unsigned char s_DCBits[2][16] =
+{
+	{0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+	{0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0}
+};
+static const unsigned char s_DCValues[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const unsigned char s_ACBits[2][16] =
+{
+	{0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d},
+	{0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77}
+};
+static const unsigned char s_ACValues[2][162] =
+{
+	{
+		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+		0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+		0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+		0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+		0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+		0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+		0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+		0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+		0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+		0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+		0xf9, 0xfa
+	},
+	{
+		0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+		0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+		0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+		0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+		0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+		0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+		0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+		0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+		0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+		0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+		0xf9, 0xfa
+	}
+};
+// AAN DCT output scale of each row/column index
+static const float s_AAN[8] = {1.0F, 1.387039845F, 1.306562965F, 1.175875602F, 1.0F, 0.785694958F, 0.541196100F, 0.275899379F};
+
+// Entropy coded bytes of one strip, 0xFF stuffed with 0x00
+typedef struct
+{
+	std::vector<unsigned char> *pOut;
+	uint32_t bits;
+	int count;
+} BITWRITER;
+static inline void PutBits(BITWRITER &w, uint32_t code, int size)
+{
+	w.bits = (w.bits << size) | code;
+	w.count += size;
+	while (w.count >= 8)
+	{
+		w.count -= 8;
+		unsigned char byte = (unsigned char)(w.bits >> w.count);
+		w.pOut->push_back(byte);
+		if (byte == 0xFF)
+			w.pOut->push_back(0);
+	}
+	w.bits &= (1U << w.count) - 1;
+}
+static inline void FlushBits(BITWRITER &w)
+{
+	// pad the last byte with ones
+	if (w.count > 0)
+		PutBits(w, (1U << (8 - w.count)) - 1, 8 - w.count);
+}
+static inline int BitCount(int v)
+{
+	return v ? 32 - __builtin_clz((unsigned int)v) : 0;
+}
+
+// Float AAN forward DCT of an 8x8 block in place, output scaled by s_AAN
+static void ForwardDCT(float *d)
+{
+	float t0, t1, t2, t3, t4, t5, t6, t7, t10, t11, t12, t13, z1, z2, z3, z4, z5, z11, z13;
+	float *p;
+	int i, step;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		// rows then columns
+		step = pass ? 8 : 1;
+		for (i = 0; i < 8; i++)
+		{
+			p = pass ? d + i : d + 8 * i;
+			t0 = p[0] + p[7 * step]; t7 = p[0] - p[7 * step];
+			t1 = p[step] + p[6 * step]; t6 = p[step] - p[6 * step];
+			t2 = p[2 * step] + p[5 * step]; t5 = p[2 * step] - p[5 * step];
+			t3 = p[3 * step] + p[4 * step]; t4 = p[3 * step] - p[4 * step];
+			t10 = t0 + t3; t13 = t0 - t3;
+			t11 = t1 + t2; t12 = t1 - t2;
+			p[0] = t10 + t11;
+			p[4 * step] = t10 - t11;
+			z1 = (t12 + t13) * 0.707106781F;
+			p[2 * step] = t13 + z1;
+			p[6 * step] = t13 - z1;
+			t10 = t4 + t5; t11 = t5 + t6; t12 = t6 + t7;
+			z5 = (t10 - t12) * 0.382683433F;
+			z2 = 0.541196100F * t10 + z5;
+			z4 = 1.306562965F * t12 + z5;
+			z3 = t11 * 0.707106781F;
+			z11 = t7 + z3; z13 = t7 - z3;
+			p[5 * step] = z13 + z2;
+			p[3 * step] = z13 - z2;
+			p[step] = z11 + z4;
+			p[7 * step] = z11 - z4;
+		}
+	}
+}
+
+// Load 8 bit samples of the MCU at (x0, y0), edges repeated past the image
+// colour: Y into y[0..3] (4 blocks of 8x8), Cb, Cr averaged 2x2; grey: y[0]
+template <typename T>
+static void LoadMcu(const cv::Mat &src, int x0, int y0, int shift, float y[4][64], float *cb, float *cr)
+{
+	int width = src.cols, height = src.rows;
+	int cn = src.channels();
+	const T *pRow;
+	int i, j, x, v, b, g, r;
+	float fy;
+	if (cn == 1)
+	{
+		for (i = 0; i < 8; i++)
+		{
+			pRow = (const T *)src.ptr((y0 + i < height) ? y0 + i : height - 1);
+			for (j = 0; j < 8; j++)
+			{
+				x = (x0 + j < width) ? x0 + j : width - 1;
+				v = pRow[x] >> shift;
+				y[0][8 * i + j] = (float)((v > 255) ? 255 : v) - 128.0F;
+			}
+		}
+		return;
+	}
+	for (i = 0; i < 64; i++)
+		cb[i] = cr[i] = 0.0F;
+	for (i = 0; i < 16; i++)
+	{
+		pRow = (const T *)src.ptr((y0 + i < height) ? y0 + i : height - 1);
+		for (j = 0; j < 16; j++)
+		{
+			x = 3 * ((x0 + j < width) ? x0 + j : width - 1);
+			b = pRow[x] >> shift; g = pRow[x + 1] >> shift; r = pRow[x + 2] >> shift;
+			b = (b > 255) ? 255 : b; g = (g > 255) ? 255 : g; r = (r > 255) ? 255 : r;
+			fy = 0.299F * r + 0.587F * g + 0.114F * b;
+			y[((i >> 3) << 1) + (j >> 3)][8 * (i & 7) + (j & 7)] = fy - 128.0F;
+			// chroma of the 2x2 cell is the mean, 0.25 is folded in here
+			v = 8 * (i >> 1) + (j >> 1);
+			cb[v] += 0.25F * (0.564F * (b - fy));
+			cr[v] += 0.25F * (0.713F * (r - fy));
+		}
+	}
+}
+
+// strips [first..) of a frame for the thread pool
+typedef struct
+{
+	JpegEncoder *pEncoder;
+	int first;
+} JPEG_JOB;
+static void EncodeTask(void *arg, int part)
+{
+	JPEG_JOB *pJob = (JPEG_JOB *)arg;
+	pJob->pEncoder->EncodeStrip(pJob->first + part);
+}
+
+JpegEncoder::JpegEncoder(int quality, ThreadPool *pPool)
+{
+	m_pPool = pPool ? pPool : ThreadPool::Shared();
+	m_Shift = 8;
+	m_Components = 3;
+	m_McuSize = 16;
+	m_StripRows = JPEG_STRIP_ROWS;
+	m_Next = 0;
+	// Huffman codes from the Annex K counts and symbols
+	int t, len, i, k, code;
+	for (t = 0; t < 2; t++)
+	{
+		memset(&m_DC[t], 0, sizeof(HUFFMAN));
+		memset(&m_AC[t], 0, sizeof(HUFFMAN));
+		for (len = 1, k = 0, code = 0; len <= 16; len++, code <<= 1)
+		{
+			for (i = 0; i < s_DCBits[t][len - 1]; i++, k++, code++)
+			{
+				m_DC[t].code[s_DCValues[k]] = (unsigned short)code;
+				m_DC[t].size[s_DCValues[k]] = (unsigned char)len;
+			}
+		}
+		for (len = 1, k = 0, code = 0; len <= 16; len++, code <<= 1)
+		{
+			for (i = 0; i < s_ACBits[t][len - 1]; i++, k++, code++)
+			{
+				m_AC[t].code[s_ACValues[t][k]] = (unsigned short)code;
+				m_AC[t].size[s_ACValues[t][k]] = (unsigned char)len;
+			}
+		}
+	}
+	SetQuality(quality);
+}
+JpegEncoder::~JpegEncoder()
+{
+}
+void JpegEncoder::SetQuality(int quality)
+{
+	// IJG scaling of the Annex K tables
+	m_Quality = (quality < 1) ? 1 : ((quality > 100) ? 100 : quality);
+	int scale = (m_Quality < 50) ? 5000 / m_Quality : 200 - 2 * m_Quality;
+	int q[64];
+	for (int t = 0; t < 2; t++)
+	{
+		for (int i = 0; i < 64; i++)
+		{
+			q[i] = (s_BaseQuant[t][i] * scale + 50) / 100;
+			q[i] = (q[i] < 1) ? 1 : ((q[i] > 255) ? 255 : q[i]);
+			m_Scale[t][i] = 1.0F / (q[i] * s_AAN[i >> 3] * s_AAN[i & 7] * 8.0F);
+		}
+		for (int k = 0; k < 64; k++)
+			m_Quant[t][k] = (unsigned char)q[s_Zigzag[k]];
+	}
+}
+JpegEncoder::ERR JpegEncoder::Begin(const cv::Mat &src, int stripRows)
+{
+	if (((src.depth() != CV_8U) && (src.depth() != CV_16U)) || ((src.channels() != 1) && (src.channels() != 3))
+		|| (src.cols < 1) || (src.rows < 1) || (src.cols > 65535) || (src.rows > 65535))
+	{
+		fprintf(stderr,"Error: JPEG of this image not supported");
+		return FAIL;
+	}
+	m_Src = src;
+	m_Components = src.channels();
+	m_McuSize = (m_Components == 3) ? 16 : 8;
+	// whole MCU rows, and a restart interval that fits in 16 bits
+	m_StripRows = ((stripRows + 15) / 16) * 16;
+	int mcusPerRow = (src.cols + m_McuSize - 1) / m_McuSize;
+	while ((m_StripRows > 16) && ((m_StripRows / m_McuSize) * mcusPerRow > 65535))
+		m_StripRows -= 16;
+	int strips = (src.rows + m_StripRows - 1) / m_StripRows;
+	m_Strips.resize(strips);
+	for (int i = 0; i < strips; i++)
+		m_Strips[i].bytes.clear();	// the capacity is kept for the next frame
+	m_Next = 0;
+	return OK;
+}
+void JpegEncoder::AddRows(int rows)
+{
+	if (m_Src.empty())
+		return;
+	Code((rows >= m_Src.rows) ? (int)m_Strips.size() : rows / m_StripRows);
+}
+JpegEncoder::ERR JpegEncoder::Finish(std::vector<unsigned char> &dst)
+{
+	if (m_Src.empty())
+		return FAIL;
+	Code((int)m_Strips.size());
+
+	size_t bytes = 1024;
+	size_t i;
+	for (i = 0; i < m_Strips.size(); i++)
+		bytes += m_Strips[i].bytes.size() + 2;
+	dst.clear();
+	dst.reserve(bytes);
+	Header(dst);
+	for (i = 0; i < m_Strips.size(); i++)
+	{
+		if (i > 0)
+		{
+			// RST0..RST7 in turn between the intervals
+			dst.push_back(0xFF);
+			dst.push_back((unsigned char)(0xD0 + ((i - 1) & 7)));
+		}
+		dst.insert(dst.end(), m_Strips[i].bytes.begin(), m_Strips[i].bytes.end());
+	}
+	dst.push_back(0xFF);
+	dst.push_back(0xD9);
+	m_Src.release();
+	return OK;
+}
+JpegEncoder::ERR JpegEncoder::Encode(const cv::Mat &src, std::vector<unsigned char> &dst)
+{
+	if (Begin(src) != OK)
+		return FAIL;
+	return Finish(dst);
+}
+void JpegEncoder::EncodeStrip(int strip)
+{
+	float y[4][64], cb[64], cr[64];
+	float *pBlock;
+	int q[64];
+	int pred[3] = {0, 0, 0};	// the DC predictions start again at each restart
+	int blocks = (m_Components == 3) ? 6 : 1;
+	int b, k, t, v, a, nb, run;
+	float f;
+	BITWRITER w;
+	w.pOut = &m_Strips[strip].bytes;
+	w.bits = 0;
+	w.count = 0;
+	int first = strip * m_StripRows;
+	int end = (first + m_StripRows < m_Src.rows) ? first + m_StripRows : m_Src.rows;
+	bool is16 = (m_Src.depth() == CV_16U);
+	for (int y0 = first; y0 < end; y0 += m_McuSize)
+	{
+		for (int x0 = 0; x0 < m_Src.cols; x0 += m_McuSize)
+		{
+			if (is16)
+				LoadMcu<unsigned short>(m_Src, x0, y0, m_Shift, y, cb, cr);
+			else
+				LoadMcu<unsigned char>(m_Src, x0, y0, 0, y, cb, cr);
+			// Y0 Y1 Y2 Y3 Cb Cr, or just Y
+			for (b = 0; b < blocks; b++)
+			{
+				pBlock = (b < 4) ? y[b] : ((b == 4) ? cb : cr);
+				t = (b < 4) ? 0 : 1;
+				ForwardDCT(pBlock);
+				for (k = 0; k < 64; k++)
+				{
+					f = pBlock[s_Zigzag[k]] * m_Scale[t][s_Zigzag[k]];
+					q[k] = (int)(f + 16384.5F) - 16384;
+				}
+				int c = (b < 4) ? 0 : b - 3;
+				v = q[0] - pred[c];
+				pred[c] = q[0];
+				a = (v < 0) ? -v : v;
+				nb = BitCount(a);
+				PutBits(w, m_DC[t].code[nb], m_DC[t].size[nb]);
+				if (nb)
+					PutBits(w, (v < 0 ? v - 1 : v) & ((1 << nb) - 1), nb);
+				run = 0;
+				for (k = 1; k < 64; k++)
+				{
+					v = q[k];
+					if (v == 0)
+					{
+						run++;
+						continue;
+					}
+					while (run > 15)
+					{
+						PutBits(w, m_AC[t].code[0xF0], m_AC[t].size[0xF0]);
+						run -= 16;
+					}
+					a = (v < 0) ? -v : v;
+					nb = BitCount(a);
+					PutBits(w, m_AC[t].code[(run << 4) | nb], m_AC[t].size[(run << 4) | nb]);
+					PutBits(w, (v < 0 ? v - 1 : v) & ((1 << nb) - 1), nb);
+					run = 0;
+				}
+				if (run > 0)
+					PutBits(w, m_AC[t].code[0x00], m_AC[t].size[0x00]);
+			}
+		}
+	}
+	FlushBits(w);
+}
+
+// ************************************************************************
+// ***************  Private Methods for JpegEncoder  **********************
+// ************************************************************************
+void JpegEncoder::Code(int ready)
+{
+	if (ready <= m_Next)
+		return;
+	JPEG_JOB job;
+	job.pEncoder = this;
+	job.first = m_Next;
+	m_pPool->Run(EncodeTask, &job, ready - m_Next);
+	m_Next = ready;
+}
+static void PutWord(std::vector<unsigned char> &dst, int v)
+{
+	dst.push_back((unsigned char)(v >> 8));
+	dst.push_back((unsigned char)v);
+}
+void JpegEncoder::Header(std::vector<unsigned char> &dst)
+{
+	static const unsigned char jfif[] = {0xFF, 0xD8, 0xFF, 0xE0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+	dst.insert(dst.end(), jfif, jfif + sizeof(jfif));
+	int tables = (m_Components == 3) ? 2 : 1;
+	int t, i;
+	// quantisation tables
+	dst.push_back(0xFF); dst.push_back(0xDB);
+	PutWord(dst, 2 + 65 * tables);
+	for (t = 0; t < tables; t++)
+	{
+		dst.push_back((unsigned char)t);
+		dst.insert(dst.end(), m_Quant[t], m_Quant[t] + 64);
+	}
+	// frame: Y at 2x2 for colour so chroma is 4:2:0
+	dst.push_back(0xFF); dst.push_back(0xC0);
+	PutWord(dst, 8 + 3 * m_Components);
+	dst.push_back(8);
+	PutWord(dst, m_Src.rows);
+	PutWord(dst, m_Src.cols);
+	dst.push_back((unsigned char)m_Components);
+	for (i = 0; i < m_Components; i++)
+	{
+		dst.push_back((unsigned char)(i + 1));
+		dst.push_back((m_Components == 3) && (i == 0) ? 0x22 : 0x11);
+		dst.push_back((unsigned char)((i == 0) ? 0 : 1));
+	}
+	// Huffman tables
+	for (t = 0; t < tables; t++)
+	{
+		int n = 0;
+		for (i = 0; i < 16; i++)
+			n += s_DCBits[t][i];
+		dst.push_back(0xFF); dst.push_back(0xC4);
+		PutWord(dst, 3 + 16 + n);
+		dst.push_back((unsigned char)t);
+		dst.insert(dst.end(), s_DCBits[t], s_DCBits[t] + 16);
+		dst.insert(dst.end(), s_DCValues, s_DCValues + n);
+		n = 0;
+		for (i = 0; i < 16; i++)
+			n += s_ACBits[t][i];
+		dst.push_back(0xFF); dst.push_back(0xC4);
+		PutWord(dst, 3 + 16 + n);
+		dst.push_back((unsigned char)(0x10 | t));
+		dst.insert(dst.end(), s_ACBits[t], s_ACBits[t] + 16);
+		dst.insert(dst.end(), s_ACValues[t], s_ACValues[t] + n);
+	}
+	// one restart interval per strip
+	dst.push_back(0xFF); dst.push_back(0xDD);
+	PutWord(dst, 4);
+	PutWord(dst, (m_StripRows / m_McuSize) * ((m_Src.cols + m_McuSize - 1) / m_McuSize));
+	// scan
+	dst.push_back(0xFF); dst.push_back(0xDA);
+	PutWord(dst, 6 + 2 * m_Components);
+	dst.push_back((unsigned char)m_Components);
+	for (i = 0; i < m_Components; i++)
+	{
+		dst.push_back((unsigned char)(i + 1));
+		dst.push_back((unsigned char)((i == 0) ? 0x00 : 0x11));
+	}
+	dst.push_back(0);
+	dst.push_back(63);
+	dst.push_back(0);
+}
@@ -0,0 +1,457 @@
+#include "rawcodec.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CODEC_ACTIVITY_BINS 4
+#define CODEC_CONTEXTS (4 * CODEC_ACTIVITY_BINS)	// CFA channel x local activity
+#define CODEC_RESET 64		// halve the context counts this often
+#define CODEC_ESCAPE_BITS 17	// a zig-zagged residual of up to 16 bit samples
+
+// LSB first bit writer, stores a whole word every time and moves on by
+// the bytes completed, so there is no branch to mispredict on noisy data.
+// Needs 8 bytes of room past the data.
+typedef struct
+{
+	uint8_t *p;
+	uint64_t acc;
+	int n;		// bits in acc, under 8 between calls
+} BITWRITER;
+static inline void Put(BITWRITER &w, uint32_t v, int bits)	// bits <= 32
+{
+	w.acc |= (uint64_t)v << w.n;
+	w.n += bits;
+	memcpy(w.p, &w.acc, 8);
+	w.p += w.n >> 3;
+	w.acc >>= w.n & ~7;
+	w.n &= 7;
+}
+static inline void Flush(BITWRITER &w)
+{
+	if (w.n > 0)
+		*w.p++ = (uint8_t)w.acc;
+	w.acc = 0;
+	w.n = 0;
+}
+
+// LSB first bit reader, keeps at least 56 bits ready after Fill()
+typedef struct
+{
+	const uint8_t *p;
+	const uint8_t *end;
+	uint64_t acc;
+	int n;
+} BITREADER;
+static inline void Fill(BITREADER &r)
+{
+	if (r.p + 8 <= r.end)
+	{
+		uint64_t v;
+		memcpy(&v, r.p, 8);
+		r.acc |= v << r.n;
+		r.p += (63 - r.n) >> 3;
+		r.n |= 56;
+		return;
+	}
+	while (r.n <= 56)
+	{
+		r.acc |= (uint64_t)((r.p < r.end) ? *r.p : 0) << r.n;
+		r.p++;	// may pass end, checked once the strip is done
+		r.n += 8;
+	}
+}
+static inline uint32_t Get(BITREADER &r, int bits)
+{
+	uint32_t v = (uint32_t)r.acc & ((1u << bits) - 1);
+	r.acc >>= bits;
+	r.n -= bits;
+	return v;
+}
+
+// LOCO-I median predictor from left a, up b and up-left c,
+// written as selects since noise makes its branches unpredictable
+static inline int Predict(int a, int b, int c)
+{
+	int lo = (a < b) ? a : b;
+	int hi = (a < b) ? b : a;
+	int p = a + b - c;
+	p = (c >= hi) ? lo : p;
+	return (c <= lo) ? hi : p;
+}
+// local activity in CODEC_ACTIVITY_BINS bins split at 4, 16 and 64
+static inline int Activity(int a, int b, int c)
+{
+	int d = abs(a - c) + abs(b - c);
+	int bin = (31 - __builtin_clz(d | 1)) >> 1;
+	return (bin < CODEC_ACTIVITY_BINS - 1) ? bin : CODEC_ACTIVITY_BINS - 1;
+}
+// smallest k with N << k >= A, the mean residual of the context in bits
+static inline int RiceK(int A, int N)
+{
+	int k = __builtin_clz(N) - __builtin_clz(A | 1);
+	k &= ~(k >> 31);	// 0 when A <= N, without a branch
+	return k + ((N << k) < A);
+}
+
+// Golomb-Rice code of u with parameter k, escaped past CODEC_RICE_LIMIT
+static inline void PutRice(BITWRITER &w, uint32_t u, int k)
+{
+	uint32_t q = u >> k;
+	if (q < CODEC_RICE_LIMIT)
+	{
+		if (q + 1 + k <= 32)
+			Put(w, (1u << q) | ((u & ((1u << k) - 1)) << (q + 1)), q + 1 + k);
+		else
+		{
+			Put(w, 1u << q, q + 1);
+			Put(w, u & ((1u << k) - 1), k);
+		}
+	}
+	else
+	{
+		Put(w, 1u << CODEC_RICE_LIMIT, CODEC_RICE_LIMIT + 1);
+		Put(w, u, CODEC_ESCAPE_BITS);
+	}
+}
+static inline uint32_t GetRice(BITREADER &r, int k)
+{
+	Fill(r);
+	int q = r.acc ? __builtin_ctzll(r.acc) : 64;
+	if (q < CODEC_RICE_LIMIT)
+	{
+		r.acc >>= q + 1;
+		r.n -= q + 1;
+		return ((uint32_t)q << k) | Get(r, k);
+	}
+	Get(r, CODEC_RICE_LIMIT + 1);
+	return Get(r, CODEC_ESCAPE_BITS);
+}
+// adapt the context of a coded residual
+#define CODEC_UPDATE(ctx, u) \
+	A[ctx] += (u); \
+	if (++N[ctx] >= CODEC_RESET) \
+	{ \
+		A[ctx] >>= 1; \
+		N[ctx] >>= 1; \
+	}
+
+static void EncodeTask(void *arg, int part)
+{
+	((RawCodec *)arg)->EncodeStrip(part);
+}
+static void DecodeTask(void *arg, int part)
+{
+	((RawCodec *)arg)->DecodeStrip(part);
+}
+
+RawCodec::RawCodec(int bits, int stripRows, ThreadPool *pPool)
+{
+	m_pPool = pPool ? pPool : ThreadPool::Shared();
+	m_Bits = (bits < 1) ? 1 : ((bits > 16) ? 16 : bits);
+	m_StripRows = (stripRows < 2) ? 2 : (stripRows & ~1);	// keep the CFA phase
+	m_Width = m_Height = m_Strips = 0;
+	m_pSrc = NULL;
+	m_pDst = NULL;
+	m_Failed = 0;
+}
+RawCodec::~RawCodec()
+{
+}
+int RawCodec::MaxBytes(int width, int height)
+{
+	int strips = (height + m_StripRows - 1) / m_StripRows;
+	return (int)sizeof(CODEC_HEADER) + 4 * strips + strips * (1 + CODEC_PAD) + width * height * 2;
+}
+int RawCodec::Encode(const uint8_t *src, int width, int height, uint8_t *dst, int dstLen)
+{
+	if ((width < 2) || (height < 2) || (src == NULL) || (dst == NULL))
+	{
+		fprintf(stderr,"Error: Coding a %dx%d frame", width, height);
+		return -1;
+	}
+	m_Width = width;
+	m_Height = height;
+	m_Strips = (height + m_StripRows - 1) / m_StripRows;
+	m_pSrc = src;
+	m_Scratch.resize((size_t)m_Strips * (StripBytes(m_StripRows) + width * 8));
+	m_StripBytes.resize(m_Strips);
+	m_pPool->Run(EncodeTask, this, m_Strips);
+
+	// header, strip sizes, then the strips end to end
+	int total = (int)sizeof(CODEC_HEADER) + 4 * m_Strips;
+	for (int s = 0; s < m_Strips; s++)
+		total += m_StripBytes[s];
+	if (total > dstLen)
+	{
+		fprintf(stderr,"Error: Coded frame needs %d bytes", total);
+		return -1;
+	}
+	CODEC_HEADER header;
+	memcpy(header.magic, CODEC_MAGIC, 4);
+	header.width = width;
+	header.height = height;
+	header.bits = m_Bits;
+	header.stripRows = m_StripRows;
+	header.strips = m_Strips;
+	header.bytes = total;
+	memcpy(dst, &header, sizeof(header));
+	uint8_t *p = dst + sizeof(header);
+	for (int s = 0; s < m_Strips; s++)
+	{
+		uint32_t bytes = m_StripBytes[s];
+		memcpy(p, &bytes, 4);
+		p += 4;
+	}
+	size_t room = StripBytes(m_StripRows) + width * 8;
+	for (int s = 0; s < m_Strips; s++)
+	{
+		memcpy(p, &m_Scratch[s * room], m_StripBytes[s]);
+		p += m_StripBytes[s];
+	}
+	return total;
+}
+RawCodec::ERR RawCodec::Info(const uint8_t *src, int srcLen, int &width, int &height, int &bytes)
+{
+	CODEC_HEADER header;
+	if ((src == NULL) || (srcLen < (int)sizeof(header)))
+		return FAIL;
+	memcpy(&header, src, sizeof(header));
+	if (memcmp(header.magic, CODEC_MAGIC, 4) != 0)
+		return FAIL;
+	width = header.width;
+	height = header.height;
+	bytes = header.bytes;
+	return OK;
+}
+RawCodec::ERR RawCodec::Decode(const uint8_t *src, int srcLen, uint8_t *dst, int dstLen)
+{
+	CODEC_HEADER header;
+	if ((src == NULL) || (srcLen < (int)sizeof(header)))
+		return FAIL;
+	memcpy(&header, src, sizeof(header));
+	if ((memcmp(header.magic, CODEC_MAGIC, 4) != 0) || ((int)header.bytes > srcLen) || (header.stripRows < 2)
+		|| (header.bits < 1) || (header.bits > 16)
+		|| (header.strips != (header.height + header.stripRows - 1) / header.stripRows))
+	{
+		fprintf(stderr,"Error: Not a coded frame");
+		return FAIL;
+	}
+	if ((int)(header.width * header.height * 2) > dstLen)
+	{
+		fprintf(stderr,"Error: Decoded frame needs %d bytes", header.width * header.height * 2);
+		return FAIL;
+	}
+	m_Width = header.width;
+	m_Height = header.height;
+	m_Bits = header.bits;
+	m_StripRows = header.stripRows;
+	m_Strips = header.strips;
+	m_pDst = dst;
+	m_StripBytes.resize(m_Strips);
+	m_StripData.resize(m_Strips);
+	const uint8_t *p = src + sizeof(header);
+	const uint8_t *end = src + header.bytes;
+	const uint8_t *data = p + 4 * m_Strips;
+	for (int s = 0; s < m_Strips; s++)
+	{
+		uint32_t bytes;
+		memcpy(&bytes, p + 4 * s, 4);
+		if ((bytes < 1 + CODEC_PAD) || (data + bytes > end))
+		{
+			fprintf(stderr,"Error: Coded frame is truncated");
+			return FAIL;
+		}
+		m_StripBytes[s] = bytes;
+		m_StripData[s] = data;
+		data += bytes;
+	}
+	m_Failed = 0;
+	m_pPool->Run(DecodeTask, this, m_Strips);
+	if (m_Failed)
+	{
+		fprintf(stderr,"Error: Coded frame is corrupt");
+		return FAIL;
+	}
+	return OK;
+}
+void RawCodec::EncodeStrip(int strip)
+{
+	int first = strip * m_StripRows;
+	int rows = (first + m_StripRows <= m_Height) ? m_StripRows : m_Height - first;
+	int count = rows * m_Width;
+	const uint16_t *pSrc = (const uint16_t *)m_pSrc + first * m_Width;
+	uint8_t *pOut = &m_Scratch[strip * (StripBytes(m_StripRows) + m_Width * 8)];
+	int packed = (count * m_Bits + 7) / 8;
+	int n = EncodeRice(pSrc, rows, pOut + 1);
+	if ((n >= 0) && (n <= packed))
+		pOut[0] = CODEC_RICE;
+	else if (n != -1)
+	{
+		pOut[0] = CODEC_PACKED;
+		n = EncodePacked(pSrc, count, pOut + 1);
+	}
+	else
+	{
+		// a sample above the significant bits, keep the frame exact
+		pOut[0] = CODEC_Y16;
+		n = count * 2;
+		memcpy(pOut + 1, pSrc, n);
+	}
+	memset(pOut + 1 + n, 0, CODEC_PAD);
+	m_StripBytes[strip] = 1 + n + CODEC_PAD;
+}
+void RawCodec::DecodeStrip(int strip)
+{
+	int first = strip * m_StripRows;
+	int rows = (first + m_StripRows <= m_Height) ? m_StripRows : m_Height - first;
+	int count = rows * m_Width;
+	uint16_t *pDst = (uint16_t *)m_pDst + first * m_Width;
+	const uint8_t *pIn = m_StripData[strip];
+	int len = m_StripBytes[strip] - 1 - CODEC_PAD;
+	ERR err = FAIL;
+	switch (pIn[0])
+	{
+	case CODEC_RICE:
+		err = DecodeRice(pIn + 1, len, pDst, rows);
+		break;
+	case CODEC_PACKED:
+		err = DecodePacked(pIn + 1, len, pDst, count);
+		break;
+	case CODEC_Y16:
+		if (len == count * 2)
+		{
+			memcpy(pDst, pIn + 1, len);
+			err = OK;
+		}
+		break;
+	default:
+		break;
+	}
+	if (err != OK)
+		m_Failed = 1;
+}
+
+// ************************************************************************
+// ***************  Private Methods for RawCodec  *************************
+// ************************************************************************
+// Returns the bytes written, -1 if a sample does not fit the significant
+// bits or -2 once the strip is bigger than packing it would be.
+int RawCodec::EncodeRice(const uint16_t *pSrc, int rows, uint8_t *pDst)
+{
+	int A[CODEC_CONTEXTS], N[CODEC_CONTEXTS];
+	for (int i = 0; i < CODEC_CONTEXTS; i++)
+	{
+		A[i] = 4;
+		N[i] = 1;
+	}
+	int width = m_Width;
+	int maxv = (1 << m_Bits) - 1;
+	int limit = (rows * width * m_Bits + 7) / 8;
+	BITWRITER w = {pDst, 0, 0};
+	const uint16_t *row, *up;
+	int x, y, a, b, c, e, ctx, over;
+	uint32_t u;
+	for (y = 0; y < rows; y++)
+	{
+		row = pSrc + y * width;
+		up = (y >= 2) ? row - 2 * width : NULL;
+		over = 0;
+		// same colour neighbours are two sites away, the first two rows
+		// and columns of a strip have only some of them
+		for (x = 0; x < width; x++)
+		{
+			over |= row[x];
+			if (up && (x >= 2))
+				break;
+			e = row[x] - (up ? up[x] : ((x >= 2) ? row[x - 2] : (maxv + 1) >> 1));
+			u = (uint32_t)((e << 1) ^ (e >> 31));	// zig-zag, small magnitudes first
+			ctx = (((y & 1) << 1) | (x & 1)) * CODEC_ACTIVITY_BINS;
+			PutRice(w, u, RiceK(A[ctx], N[ctx]));
+			CODEC_UPDATE(ctx, u);
+		}
+		for (; x < width; x++)
+		{
+			a = row[x - 2]; b = up[x]; c = up[x - 2];
+			over |= row[x];
+			e = row[x] - Predict(a, b, c);
+			u = (uint32_t)((e << 1) ^ (e >> 31));
+			ctx = (((y & 1) << 1) | (x & 1)) * CODEC_ACTIVITY_BINS + Activity(a, b, c);
+			PutRice(w, u, RiceK(A[ctx], N[ctx]));
+			CODEC_UPDATE(ctx, u);
+		}
+		if (over & ~maxv)
+			return -1;
+		if (w.p - pDst > limit)
+			return -2;
+	}
+	Flush(w);
+	return (int)(w.p - pDst);
+}
+int RawCodec::EncodePacked(const uint16_t *pSrc, int count, uint8_t *pDst)
+{
+	BITWRITER w = {pDst, 0, 0};
+	for (int i = 0; i < count; i++)
+		Put(w, pSrc[i], m_Bits);
+	Flush(w);
+	return (int)(w.p - pDst);
+}
+RawCodec::ERR RawCodec::DecodeRice(const uint8_t *pSrc, int srcLen, uint16_t *pDst, int rows)
+{
+	int A[CODEC_CONTEXTS], N[CODEC_CONTEXTS];
+	for (int i = 0; i < CODEC_CONTEXTS; i++)
+	{
+		A[i] = 4;
+		N[i] = 1;
+	}
+	int width = m_Width;
+	int maxv = (1 << m_Bits) - 1;
+	// the pad after the strip keeps whole word reads inside the buffer
+	BITREADER r = {pSrc, pSrc + srcLen + CODEC_PAD, 0, 0};
+	uint16_t *row;
+	const uint16_t *up;
+	int x, y, a, b, c, v, ctx, over;
+	uint32_t u;
+	for (y = 0; y < rows; y++)
+	{
+		row = pDst + y * width;
+		up = (y >= 2) ? row - 2 * width : NULL;
+		over = 0;
+		for (x = 0; x < width; x++)
+		{
+			if (up && (x >= 2))
+				break;
+			ctx = (((y & 1) << 1) | (x & 1)) * CODEC_ACTIVITY_BINS;
+			u = GetRice(r, RiceK(A[ctx], N[ctx]));
+			v = (up ? up[x] : ((x >= 2) ? row[x - 2] : (maxv + 1) >> 1)) + ((int)(u >> 1) ^ -(int)(u & 1));
+			over |= v;
+			row[x] = (uint16_t)v;
+			CODEC_UPDATE(ctx, u);
+		}
+		for (; x < width; x++)
+		{
+			a = row[x - 2]; b = up[x]; c = up[x - 2];
+			ctx = (((y & 1) << 1) | (x & 1)) * CODEC_ACTIVITY_BINS + Activity(a, b, c);
+			u = GetRice(r, RiceK(A[ctx], N[ctx]));
+			v = Predict(a, b, c) + ((int)(u >> 1) ^ -(int)(u & 1));
+			over |= v;
+			row[x] = (uint16_t)v;
+			CODEC_UPDATE(ctx, u);
+		}
+		// negative or too large, the stream is corrupt
+		if (over & ~maxv)
+			return FAIL;
+	}
+	// everything read must have come from the strip
+	return ((r.p - (r.n >> 3)) <= pSrc + srcLen) ? OK : FAIL;
+}
+RawCodec::ERR RawCodec::DecodePacked(const uint8_t *pSrc, int srcLen, uint16_t *pDst, int count)
+{
+	if (srcLen < (count * m_Bits + 7) / 8)
+		return FAIL;
+	BITREADER r = {pSrc, pSrc + srcLen + CODEC_PAD, 0, 0};
+	for (int i = 0; i < count; i++)
+	{
+		Fill(r);
+		pDst[i] = (uint16_t)Get(r, m_Bits);
+	}
+	return OK;
+}
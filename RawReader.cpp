@@ -0,0 +1,219 @@
+#include "rawreader.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+RawReader::RawReader()
+{
+	m_pMap = NULL;
+	m_Size = 0;
+	m_pHeader = NULL;
+	m_pIndex = NULL;
+	m_Frames = 0;
+	m_pCodec = NULL;
+}
+RawReader::~RawReader()
+{
+	Close();
+}
+RawReader::ERR RawReader::Open(std::string fileName)
+{
+	Close();
+	int fd = open(fileName.data(), O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr,"Error: Opening %s", fileName.data());
+		return FAIL;
+	}
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || (st.st_size < RECORD_ALIGN))
+	{
+		fprintf(stderr,"Error: %s is not a raw recording", fileName.data());
+		close(fd);
+		return FAIL;
+	}
+	m_Size = (size_t)st.st_size;
+	// private and writable: in place processing copies the pages it touches
+	void *p = mmap(NULL, m_Size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);	// the mapping keeps the file
+	if (p == MAP_FAILED)
+	{
+		fprintf(stderr,"Error: Mapping %s", fileName.data());
+		return FAIL;
+	}
+	m_pMap = (uint8_t *)p;
+	m_pHeader = (const RAW_HEADER *)m_pMap;
+	if ((memcmp(m_pHeader->magic, RAW_MAGIC, 4) != 0) || (m_pHeader->version != RAW_VERSION)
+		|| (m_pHeader->stride < m_pHeader->frameBytes) || (m_pHeader->stride == 0))
+	{
+		fprintf(stderr,"Error: %s is not a raw recording", fileName.data());
+		Close();
+		return FAIL;
+	}
+	if (m_pHeader->codec >= RAW_CODECS)
+	{
+		fprintf(stderr,"Error: %s uses unknown codec %u", fileName.data(), m_pHeader->codec);
+		Close();
+		return FAIL;
+	}
+	uint64_t indexEnd = m_pHeader->indexOffset + (uint64_t)m_pHeader->frames * sizeof(RAW_ENTRY);
+	if ((m_pHeader->indexOffset != 0) && (indexEnd <= m_Size))
+	{
+		m_pIndex = (const RAW_ENTRY *)(m_pMap + m_pHeader->indexOffset);
+		m_Frames = (int)m_pHeader->frames;
+	}
+	else if (m_pHeader->codec == RAW_CODEC_NONE)
+	{
+		// not closed, count the whole slots
+		m_Frames = (int)((m_Size - m_pHeader->headerBytes) / m_pHeader->stride);
+	}
+	else
+	{
+		// not closed, walk the coded frames
+		uint64_t offset = m_pHeader->headerBytes;
+		int width, height, bytes;
+		while ((offset < m_Size) && (RawCodec::Info(m_pMap + offset, (int)(m_Size - offset), width, height, bytes) == RawCodec::OK)
+			   && (bytes > 0) && (offset + bytes <= m_Size))
+		{
+			m_Offsets.push_back(offset);
+			m_Bytes.push_back(bytes);
+			offset += (bytes + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+		}
+		m_Frames = (int)m_Offsets.size();
+	}
+	if (m_pHeader->codec != RAW_CODEC_NONE)
+		m_pCodec = new RawCodec(m_pHeader->bits);
+	// scrubbing jumps around, only read ahead within a frame (Prefetch)
+	madvise(m_pMap, m_Size, MADV_RANDOM);
+	return OK;
+}
+void RawReader::Close()
+{
+	if (m_pMap)
+		munmap(m_pMap, m_Size);
+	m_pMap = NULL;
+	m_Size = 0;
+	m_pHeader = NULL;
+	m_pIndex = NULL;
+	m_Frames = 0;
+	m_Offsets.clear();
+	m_Bytes.clear();
+	delete m_pCodec;
+	m_pCodec = NULL;
+}
+uint8_t *RawReader::Frame(int i, int *pLen)
+{
+	if ((m_pMap == NULL) || (i < 0) || (i >= m_Frames))
+		return NULL;
+	uint64_t offset;
+	int bytes;
+	if (m_pIndex)
+	{
+		offset = m_pIndex[i].offset;
+		bytes = (int)m_pIndex[i].bytes;
+	}
+	else if (!m_Offsets.empty())
+	{
+		offset = m_Offsets[i];
+		bytes = (int)m_Bytes[i];
+	}
+	else
+	{
+		offset = m_pHeader->headerBytes + (uint64_t)i * m_pHeader->stride;
+		bytes = (int)m_pHeader->frameBytes;
+	}
+	if (offset + bytes > m_Size)
+		return NULL;
+	if (pLen)
+		*pLen = bytes;
+	return m_pMap + offset;
+}
+cv::Mat RawReader::View(int i)
+{
+	int bytes;
+	uint8_t *p = Frame(i, &bytes);
+	if ((p == NULL) || Compressed() || (bytes < (int)m_pHeader->frameBytes))
+		return cv::Mat();
+	return cv::Mat(Height(), Width(), CV_16UC1, p);
+}
+RawReader::ERR RawReader::Decode(int i, cv::Mat &dst)
+{
+	int bytes;
+	uint8_t *p = Frame(i, &bytes);
+	if (p == NULL)
+		return FAIL;
+	dst.create(Height(), Width(), CV_16UC1);
+	if (!Compressed())
+	{
+		memcpy(dst.ptr(), p, (bytes < (int)m_pHeader->frameBytes) ? bytes : m_pHeader->frameBytes);
+		return OK;
+	}
+	if (m_pCodec->Decode(p, bytes, dst.ptr(), (int)m_pHeader->frameBytes) != RawCodec::OK)
+	{
+		fprintf(stderr,"Error: Decoding Frame %d", i);
+		return FAIL;
+	}
+	return OK;
+}
+RawReader::ERR RawReader::Entry(int i, RAW_ENTRY &entry)
+{
+	if ((m_pIndex == NULL) || (i < 0) || (i >= m_Frames))
+		return FAIL;
+	entry = m_pIndex[i];
+	return OK;
+}
+int RawReader::Find(struct timeval t)
+{
+	if (m_pIndex == NULL)
+		return -1;
+	int64_t us = (int64_t)t.tv_sec * 1000000 + t.tv_usec;
+	// frames are in capture order, binary search for the last one not after t
+	int lo = 0, hi = m_Frames - 1, mid, found = -1;
+	while (lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		if (m_pIndex[mid].seconds * 1000000 + m_pIndex[mid].microseconds <= us)
+		{
+			found = mid;
+			lo = mid + 1;
+		}
+		else
+			hi = mid - 1;
+	}
+	return found;
+}
+int RawReader::FindSequence(uint32_t sequence)
+{
+	if (m_pIndex == NULL)
+		return -1;
+	// dropped frames leave gaps, but the order holds
+	int lo = 0, hi = m_Frames - 1, mid;
+	while (lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		if (m_pIndex[mid].sequence == sequence)
+			return mid;
+		if (m_pIndex[mid].sequence < sequence)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+void RawReader::Prefetch(int i, int count)
+{
+	int bytes;
+	uint8_t *p;
+	long page = sysconf(_SC_PAGESIZE);
+	for (int k = 0; k < count; k++)
+	{
+		p = Frame(i + k, &bytes);
+		if (p == NULL)
+			break;
+		// slots are RECORD_ALIGN aligned, which is a multiple of the page size here
+		uintptr_t start = (uintptr_t)p & ~(uintptr_t)(page - 1);
+		madvise((void *)start, (uintptr_t)p + bytes - start, MADV_WILLNEED);
+	}
+}
@@ -0,0 +1,325 @@
+#include "rawrecorder.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+RawRecorder::RawRecorder(int slots)
+{
+	m_fd = -1;
+	m_pIndex = NULL;
+	m_FrameBytes = 0;
+	m_Stride = 0;
+	m_Slots.resize((slots < 2) ? 2 : slots);
+	for (size_t i = 0; i < m_Slots.size(); i++)
+		m_Slots[i].pData = NULL;
+	m_Head = m_Tail = m_Queued = 0;
+	m_Quit = false;
+	m_Failed = false;
+	m_Frames = 0;
+	m_Dropped = 0;
+	m_Offset = 0;
+	m_Compress = false;
+	m_pCodec = NULL;
+	m_pPool = NULL;
+	m_pCoded = NULL;
+	m_CodedRoom = 0;
+	pthread_mutex_init(&m_Lock, NULL);
+	pthread_cond_init(&m_Ready, NULL);
+}
+RawRecorder::~RawRecorder()
+{
+	Close();
+	pthread_cond_destroy(&m_Ready);
+	pthread_mutex_destroy(&m_Lock);
+}
+RawRecorder::ERR RawRecorder::Open(std::string fileName, int width, int height, int bits)
+{
+	Close();
+	m_FrameBytes = width * height * 2;
+	m_Stride = (m_FrameBytes + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+	m_fd = open(fileName.data(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if ((m_fd < 0) && (errno == EINVAL))
+	{
+		// tmpfs and some network file systems do not take O_DIRECT
+		m_fd = open(fileName.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if (m_fd < 0)
+	{
+		fprintf(stderr,"Error: Opening %s", fileName.data());
+		return FAIL;
+	}
+	std::string indexName = fileName + ".idx";
+	m_pIndex = fopen(indexName.data(), "w");
+	if (m_pIndex == NULL)
+	{
+		fprintf(stderr,"Error: Opening %s", indexName.data());
+		close(m_fd);
+		m_fd = -1;
+		return FAIL;
+	}
+	fprintf(m_pIndex, "# raw Y16 %dx%d frame %d bytes stride %d\n", width, height, m_FrameBytes, m_Stride);
+	fprintf(m_pIndex, "# sequence seconds microseconds offset bytes exposure\n");
+	m_Quit = true;	// no writer thread yet
+	for (size_t i = 0; i < m_Slots.size(); i++)
+	{
+		if (posix_memalign((void **)&m_Slots[i].pData, RECORD_ALIGN, m_Stride) != 0)
+		{
+			fprintf(stderr,"Error: Allocating Record Buffers");
+			m_Slots[i].pData = NULL;
+			Close();
+			return FAIL;
+		}
+		// the padding past the frame is written too, keep it clean
+		memset(m_Slots[i].pData, 0, m_Stride);
+	}
+	m_Head = m_Tail = m_Queued = 0;
+	m_Failed = false;
+	m_Frames = 0;
+	m_Dropped = 0;
+	m_Entries.clear();
+	// the header is written again with the index on Close()
+	memset(&m_Header, 0, sizeof(m_Header));
+	memcpy(m_Header.magic, RAW_MAGIC, 4);
+	m_Header.version = RAW_VERSION;
+	m_Header.headerBytes = RECORD_ALIGN;
+	m_Header.width = width;
+	m_Header.height = height;
+	m_Header.cfa = RAW_CFA_BGIRR;
+	m_Header.bits = bits;
+	m_Header.frameBytes = m_FrameBytes;
+	m_Header.stride = m_Stride;
+	if (m_Compress)
+	{
+		m_pPool = new ThreadPool();
+		m_pCodec = new RawCodec(bits, CODEC_STRIP_ROWS, m_pPool);
+		// the bit writer may store a word past the end of the frame
+		m_CodedRoom = (m_pCodec->MaxBytes(width, height) + 8 + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+		if (posix_memalign((void **)&m_pCoded, RECORD_ALIGN, m_CodedRoom) != 0)
+		{
+			fprintf(stderr,"Error: Allocating Record Buffers");
+			m_pCoded = NULL;
+			Close();
+			return FAIL;
+		}
+		m_Header.codec = RAW_CODEC_RICE;
+	}
+	memcpy(m_Slots[0].pData, &m_Header, sizeof(m_Header));
+	bool written = (WriteBlocks(m_Slots[0].pData, RECORD_ALIGN, 0) == OK);
+	memset(m_Slots[0].pData, 0, sizeof(m_Header));
+	if (!written)
+	{
+		fprintf(stderr,"Error: Writing %s", fileName.data());
+		Close();
+		return FAIL;
+	}
+	m_Offset = RECORD_ALIGN;
+	m_Quit = false;
+	if (pthread_create(&m_Thread, NULL, Writer, this) != 0)
+	{
+		fprintf(stderr,"Error: Creating Writer Thread");
+		m_Quit = true;	// nothing to join
+		Close();
+		return FAIL;
+	}
+	return OK;
+}
+void RawRecorder::Close()
+{
+	if (m_fd < 0)
+		return;
+	pthread_mutex_lock(&m_Lock);
+	bool running = !m_Quit;
+	m_Quit = true;
+	pthread_cond_signal(&m_Ready);
+	pthread_mutex_unlock(&m_Lock);
+	if (running)
+		pthread_join(m_Thread, NULL);	// drains the queue first
+	if (running && !m_Failed)
+	{
+		// index after the last frame, then the header that points at it
+		int indexBytes = (int)(m_Entries.size() * sizeof(RAW_ENTRY));
+		int blocks = (indexBytes + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+		uint8_t *pBlock = NULL;
+		if (posix_memalign((void **)&pBlock, RECORD_ALIGN, (blocks > RECORD_ALIGN) ? blocks : RECORD_ALIGN) == 0)
+		{
+			memset(pBlock, 0, blocks);
+			if (indexBytes > 0)
+				memcpy(pBlock, &m_Entries[0], indexBytes);
+			if ((blocks == 0) || (WriteBlocks(pBlock, blocks, m_Offset) == OK))
+			{
+				m_Header.frames = (uint32_t)m_Entries.size();
+				m_Header.indexOffset = m_Offset;
+				memset(pBlock, 0, RECORD_ALIGN);
+				memcpy(pBlock, &m_Header, sizeof(m_Header));
+				WriteBlocks(pBlock, RECORD_ALIGN, 0);
+			}
+			free(pBlock);
+		}
+	}
+	fdatasync(m_fd);
+	close(m_fd);
+	m_fd = -1;
+	if (m_pIndex)
+		fclose(m_pIndex);
+	m_pIndex = NULL;
+	for (size_t i = 0; i < m_Slots.size(); i++)
+	{
+		free(m_Slots[i].pData);
+		m_Slots[i].pData = NULL;
+	}
+	delete m_pCodec;
+	m_pCodec = NULL;
+	delete m_pPool;
+	m_pPool = NULL;
+	free(m_pCoded);
+	m_pCoded = NULL;
+	if (m_Dropped > 0)
+		fprintf(stderr,"Recorder dropped %u of %u frames\n", m_Dropped, m_Dropped + m_Frames);
+}
+RawRecorder::ERR RawRecorder::Push(const uint8_t *src, int srcLen, uint32_t sequence, struct timeval timestamp, int exposure)
+{
+	if ((m_fd < 0) || m_Failed)
+		return FAIL;
+	pthread_mutex_lock(&m_Lock);
+	bool full = (m_Queued == (int)m_Slots.size());
+	pthread_mutex_unlock(&m_Lock);
+	if (full)
+	{
+		m_Dropped++;
+		return FAIL;
+	}
+	// the tail slot is not queued so the writer does not touch it while it is filled
+	SLOT &slot = m_Slots[m_Tail];
+	slot.bytes = (srcLen < m_FrameBytes) ? srcLen : m_FrameBytes;
+	memcpy(slot.pData, src, slot.bytes);
+	slot.sequence = sequence;
+	slot.timestamp = timestamp;
+	slot.exposure = exposure;
+	pthread_mutex_lock(&m_Lock);
+	m_Tail = (m_Tail + 1) % (int)m_Slots.size();
+	m_Queued++;
+	pthread_cond_signal(&m_Ready);
+	pthread_mutex_unlock(&m_Lock);
+	return OK;
+}
+
+RawRecorder::ERR RawRecorder::Append(const uint8_t *src, int srcLen, bool coded, uint32_t sequence, struct timeval timestamp,
+									 int exposure)
+{
+	if ((m_fd < 0) || m_Failed)
+		return FAIL;
+	if (coded)
+	{
+		if ((m_pCodec == NULL) || (((srcLen + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1)) > m_CodedRoom))
+		{
+			fprintf(stderr,"Error: Coded frame does not fit this recording");
+			return FAIL;
+		}
+		memcpy(m_pCoded, src, srcLen);
+		Store(m_pCoded, srcLen, sequence, timestamp, exposure);
+	}
+	else
+	{
+		// no writer thread in this mode, its first slot is free
+		SLOT &slot = m_Slots[0];
+		slot.bytes = (srcLen < m_FrameBytes) ? srcLen : m_FrameBytes;
+		memcpy(slot.pData, src, slot.bytes);
+		slot.sequence = sequence;
+		slot.timestamp = timestamp;
+		slot.exposure = exposure;
+		Write(slot);
+	}
+	return m_Failed ? FAIL : OK;
+}
+
+// ************************************************************************
+// ***************  Private Methods for RawRecorder  **********************
+// ************************************************************************
+void *RawRecorder::Writer(void *arg)
+{
+	RawRecorder *pRec = (RawRecorder *)arg;
+	pthread_mutex_lock(&pRec->m_Lock);
+	while (true)
+	{
+		while (!pRec->m_Quit && (pRec->m_Queued == 0))
+			pthread_cond_wait(&pRec->m_Ready, &pRec->m_Lock);
+		if (pRec->m_Queued == 0)
+			break;	// quit once the queue is empty
+		SLOT &slot = pRec->m_Slots[pRec->m_Head];
+		pthread_mutex_unlock(&pRec->m_Lock);
+
+		pRec->Write(slot);
+
+		pthread_mutex_lock(&pRec->m_Lock);
+		pRec->m_Head = (pRec->m_Head + 1) % (int)pRec->m_Slots.size();
+		pRec->m_Queued--;
+	}
+	pthread_mutex_unlock(&pRec->m_Lock);
+	return NULL;
+}
+void RawRecorder::Write(SLOT &slot)
+{
+	if (m_Failed)
+		return;
+	if (m_pCodec == NULL)
+	{
+		Store(slot.pData, slot.bytes, slot.sequence, slot.timestamp, slot.exposure);
+		return;
+	}
+	int bytes = m_pCodec->Encode(slot.pData, m_Header.width, m_Header.height, m_pCoded, m_CodedRoom);
+	if (bytes < 0)
+	{
+		m_Failed = true;
+		return;
+	}
+	Store(m_pCoded, bytes, slot.sequence, slot.timestamp, slot.exposure);
+}
+// pData is RECORD_ALIGN aligned with room to pad bytes up to a whole block
+void RawRecorder::Store(uint8_t *pData, int bytes, uint32_t sequence, struct timeval timestamp, int exposure)
+{
+	int stride = m_pCodec ? (bytes + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1) : m_Stride;
+	memset(pData + bytes, 0, stride - bytes);
+	if (WriteBlocks(pData, stride, m_Offset) != OK)
+	{
+		fprintf(stderr,"Error: Writing Raw Frame %u", sequence);
+		m_Failed = true;
+		return;
+	}
+	RAW_ENTRY entry;
+	entry.sequence = sequence;
+	entry.exposure = exposure;
+	entry.seconds = timestamp.tv_sec;
+	entry.microseconds = timestamp.tv_usec;
+	entry.offset = m_Offset;
+	entry.bytes = bytes;
+	entry.reserved = 0;
+	m_Entries.push_back(entry);
+	fprintf(m_pIndex, "%u %ld %ld %llu %d %d\n", sequence, (long)timestamp.tv_sec, (long)timestamp.tv_usec,
+			(unsigned long long)m_Offset, bytes, exposure);
+	m_Offset += stride;
+	m_Frames++;
+}
+RawRecorder::ERR RawRecorder::WriteBlocks(const void *src, int bytes, uint64_t offset)
+{
+	// whole aligned blocks at aligned offsets, as O_DIRECT needs
+	const uint8_t *p = (const uint8_t *)src;
+	int left = (bytes + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+	off_t at = (off_t)offset;
+	ssize_t n;
+	while (left > 0)
+	{
+		n = pwrite(m_fd, p, left, at);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return FAIL;
+		}
+		p += n;
+		left -= (int)n;
+		at += n;
+	}
+	return OK;
+}
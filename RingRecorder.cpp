@@ -0,0 +1,369 @@
+#include "ringrecorder.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int64_t Microseconds(const struct timeval &t)
+{
+	return (int64_t)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+RingRecorder::RingRecorder()
+	: m_Recorder(2)
+{
+	m_Width = m_Height = 0;
+	m_Bits = 10;
+	m_FrameBytes = 0;
+	m_pArena = NULL;
+	m_ArenaBytes = 0;
+	m_Next = 0;
+	m_First = m_Count = 0;
+	m_StageHead = m_StageCount = 0;
+	m_pCodec = NULL;
+	m_pPool = NULL;
+	m_pCoded = NULL;
+	m_CodedRoom = 0;
+	m_Saving = false;
+	m_SaveUntil = 0;
+	m_Quit = true;	// no threads yet
+	m_IngestStarted = m_SaverStarted = false;
+	m_Before = 0.0F;
+	m_Dropped = 0;
+	pthread_mutex_init(&m_Lock, NULL);
+	pthread_cond_init(&m_Staged, NULL);
+	pthread_cond_init(&m_Saveable, NULL);
+}
+RingRecorder::~RingRecorder()
+{
+	Release();
+	pthread_cond_destroy(&m_Saveable);
+	pthread_cond_destroy(&m_Staged);
+	pthread_mutex_destroy(&m_Lock);
+}
+RingRecorder::ERR RingRecorder::Setup(int width, int height, size_t arenaBytes, bool compress, int bits)
+{
+	Release();
+	m_Width = width;
+	m_Height = height;
+	m_Bits = bits;
+	m_FrameBytes = width * height * 2;
+	int largest = m_FrameBytes;
+	int smallest = m_FrameBytes;
+	if (compress)
+	{
+		m_pPool = new ThreadPool();
+		m_pCodec = new RawCodec(bits, CODEC_STRIP_ROWS, m_pPool);
+		largest = m_pCodec->MaxBytes(width, height);
+		smallest = width * height / 8;	// one bit a site at best
+		m_CodedRoom = largest + 8;		// the bit writer stores whole words
+		m_pCoded = (uint8_t *)malloc(m_CodedRoom);
+	}
+	if ((width < 2) || (height < 2) || (arenaBytes < (size_t)largest) || (compress && (m_pCoded == NULL)))
+	{
+		fprintf(stderr,"Error: Ring of %lu bytes for %dx%d frames not supported", (unsigned long)arenaBytes, width, height);
+		Release();
+		return FAIL;
+	}
+	m_pArena = (uint8_t *)malloc(arenaBytes);
+	if (m_pArena == NULL)
+	{
+		fprintf(stderr,"Error: Allocating Ring Arena");
+		Release();
+		return FAIL;
+	}
+	// touch every page now so the memory is really there before capture
+	memset(m_pArena, 0, arenaBytes);
+	m_ArenaBytes = arenaBytes;
+	m_Next = 0;
+	m_Frames.resize(arenaBytes / smallest + 1);
+	m_First = m_Count = 0;
+	m_Stages.resize(RING_STAGING);
+	for (size_t i = 0; i < m_Stages.size(); i++)
+	{
+		m_Stages[i].pData = (uint8_t *)malloc(m_FrameBytes);
+		if (m_Stages[i].pData == NULL)
+		{
+			fprintf(stderr,"Error: Allocating Ring Staging");
+			Release();
+			return FAIL;
+		}
+	}
+	m_StageHead = m_StageCount = 0;
+	m_Saving = false;
+	m_Dropped = 0;
+	m_Quit = false;
+	m_IngestStarted = (pthread_create(&m_IngestThread, NULL, Ingest, this) == 0);
+	m_SaverStarted = m_IngestStarted && (pthread_create(&m_SaverThread, NULL, Saver, this) == 0);
+	if (!m_SaverStarted)
+	{
+		fprintf(stderr,"Error: Creating Ring Thread");
+		Release();
+		return FAIL;
+	}
+	fprintf(stderr,"Ring of %lu MB, at least %d frames\n", (unsigned long)(arenaBytes >> 20), (int)(arenaBytes / largest));
+	return OK;
+}
+void RingRecorder::Release()
+{
+	pthread_mutex_lock(&m_Lock);
+	m_Quit = true;
+	pthread_cond_broadcast(&m_Staged);
+	pthread_cond_broadcast(&m_Saveable);
+	pthread_mutex_unlock(&m_Lock);
+	// either thread may be missing when Setup() failed half way
+	if (m_IngestStarted)
+		pthread_join(m_IngestThread, NULL);
+	if (m_SaverStarted)
+		pthread_join(m_SaverThread, NULL);
+	m_IngestStarted = m_SaverStarted = false;
+	m_Recorder.Close();
+	for (size_t i = 0; i < m_Stages.size(); i++)
+		free(m_Stages[i].pData);
+	m_Stages.clear();
+	free(m_pArena);
+	m_pArena = NULL;
+	m_ArenaBytes = 0;
+	m_Frames.clear();
+	m_First = m_Count = 0;
+	free(m_pCoded);
+	m_pCoded = NULL;
+	delete m_pCodec;
+	m_pCodec = NULL;
+	delete m_pPool;
+	m_pPool = NULL;
+	m_Saving = false;
+}
+RingRecorder::ERR RingRecorder::Push(const uint8_t *src, int srcLen, uint32_t sequence, struct timeval timestamp, int exposure)
+{
+	if (m_pArena == NULL)
+		return FAIL;
+	pthread_mutex_lock(&m_Lock);
+	bool full = (m_StageCount == (int)m_Stages.size());
+	int tail = (m_StageHead + m_StageCount) % (int)m_Stages.size();
+	pthread_mutex_unlock(&m_Lock);
+	if (full)
+	{
+		__sync_fetch_and_add(&m_Dropped, 1);
+		return FAIL;
+	}
+	// the tail stage is not counted yet so the ingest thread leaves it alone
+	STAGE &stage = m_Stages[tail];
+	stage.bytes = (srcLen < m_FrameBytes) ? srcLen : m_FrameBytes;
+	memcpy(stage.pData, src, stage.bytes);
+	stage.sequence = sequence;
+	stage.timestamp = timestamp;
+	stage.exposure = exposure;
+	pthread_mutex_lock(&m_Lock);
+	m_StageCount++;
+	pthread_cond_signal(&m_Staged);
+	pthread_mutex_unlock(&m_Lock);
+	return OK;
+}
+RingRecorder::ERR RingRecorder::Trigger(std::string fileName, float preSeconds, float postSeconds)
+{
+	pthread_mutex_lock(&m_Lock);
+	if (m_Saving || (m_Count == 0))
+	{
+		pthread_mutex_unlock(&m_Lock);
+		return FAIL;
+	}
+	// the event time is that of the newest frame, on the camera clock
+	int64_t now = Microseconds(Held(m_Count - 1).timestamp);
+	int64_t from = now - (int64_t)(preSeconds * 1e6F);
+	int64_t first = now;
+	for (int i = 0; i < m_Count; i++)
+	{
+		Held(i).save = (preSeconds < 0.0F) || (Microseconds(Held(i).timestamp) >= from);
+		if (Held(i).save && (Microseconds(Held(i).timestamp) < first))
+			first = Microseconds(Held(i).timestamp);
+	}
+	m_Before = (now - first) * 1e-6F;
+	m_SaveUntil = now + (int64_t)(postSeconds * 1e6F);
+	m_EventFile = fileName;
+	m_Saving = true;
+	pthread_cond_signal(&m_Saveable);
+	pthread_mutex_unlock(&m_Lock);
+	return OK;
+}
+int RingRecorder::Frames()
+{
+	pthread_mutex_lock(&m_Lock);
+	int count = m_Count;
+	pthread_mutex_unlock(&m_Lock);
+	return count;
+}
+float RingRecorder::Seconds()
+{
+	float seconds = 0.0F;
+	pthread_mutex_lock(&m_Lock);
+	if (m_Count > 1)
+		seconds = (Microseconds(Held(m_Count - 1).timestamp) - Microseconds(Held(0).timestamp)) * 1e-6F;
+	pthread_mutex_unlock(&m_Lock);
+	return seconds;
+}
+
+// ************************************************************************
+// ***************  Private Methods for RingRecorder  *********************
+// ************************************************************************
+void *RingRecorder::Ingest(void *arg)
+{
+	RingRecorder *pRing = (RingRecorder *)arg;
+	pthread_mutex_lock(&pRing->m_Lock);
+	while (true)
+	{
+		while (!pRing->m_Quit && (pRing->m_StageCount == 0))
+			pthread_cond_wait(&pRing->m_Staged, &pRing->m_Lock);
+		if (pRing->m_Quit)
+			break;
+		STAGE &stage = pRing->m_Stages[pRing->m_StageHead];
+		pthread_mutex_unlock(&pRing->m_Lock);
+
+		pRing->Insert(stage);
+
+		pthread_mutex_lock(&pRing->m_Lock);
+		pRing->m_StageHead = (pRing->m_StageHead + 1) % (int)pRing->m_Stages.size();
+		pRing->m_StageCount--;
+	}
+	pthread_mutex_unlock(&pRing->m_Lock);
+	return NULL;
+}
+void RingRecorder::Insert(STAGE &stage)
+{
+	const uint8_t *pData = stage.pData;
+	int bytes = stage.bytes;
+	if (m_pCodec)
+	{
+		// a short buffer is coded as a whole frame, the rest of the stage is stale
+		bytes = m_pCodec->Encode(stage.pData, m_Width, m_Height, m_pCoded, m_CodedRoom);
+		if (bytes < 0)
+		{
+			__sync_fetch_and_add(&m_Dropped, 1);
+			return;
+		}
+		pData = m_pCoded;
+	}
+	size_t offset;
+	pthread_mutex_lock(&m_Lock);
+	bool room = MakeRoom(bytes, offset);
+	pthread_mutex_unlock(&m_Lock);
+	if (!room)
+	{
+		__sync_fetch_and_add(&m_Dropped, 1);	// the arena is full of frames still to be saved
+		return;
+	}
+	// only this thread writes the arena and nothing else uses the room just made
+	memcpy(m_pArena + offset, pData, bytes);
+	pthread_mutex_lock(&m_Lock);
+	FRAME &frame = m_Frames[(m_First + m_Count) % m_Frames.size()];
+	frame.offset = offset;
+	frame.bytes = bytes;
+	frame.sequence = stage.sequence;
+	frame.timestamp = stage.timestamp;
+	frame.exposure = stage.exposure;
+	frame.save = m_Saving && (Microseconds(stage.timestamp) <= m_SaveUntil);
+	m_Count++;
+	m_Next = offset + bytes;
+	if (m_Saving)
+		pthread_cond_signal(&m_Saveable);	// also tells the saver when the event is over
+	pthread_mutex_unlock(&m_Lock);
+}
+// Finds room for bytes after the newest frame, dropping the oldest frames
+// that are in the way, FAIL if one of them is still to be saved
+bool RingRecorder::MakeRoom(int bytes, size_t &offset)
+{
+	size_t need = (size_t)bytes;
+	size_t oldest;
+	while (true)
+	{
+		if (m_Count == 0)
+		{
+			m_Next = 0;
+			offset = 0;
+			return need <= m_ArenaBytes;
+		}
+		if (m_Count < (int)m_Frames.size())
+		{
+			oldest = Held(0).offset;
+			if (m_Next > oldest)
+			{
+				// free space is past the newest frame and before the oldest
+				if (m_ArenaBytes - m_Next >= need)
+				{
+					offset = m_Next;
+					return true;
+				}
+				if (oldest >= need)
+				{
+					offset = 0;
+					return true;
+				}
+			}
+			else if ((m_Next < oldest) && (oldest - m_Next >= need))
+			{
+				offset = m_Next;
+				return true;
+			}
+		}
+		if (Held(0).save)
+			return false;
+		m_First = (m_First + 1) % (int)m_Frames.size();
+		m_Count--;
+	}
+}
+void *RingRecorder::Saver(void *arg)
+{
+	RingRecorder *pRing = (RingRecorder *)arg;
+	FRAME *pFrame;
+	FRAME frame;
+	int i;
+	pthread_mutex_lock(&pRing->m_Lock);
+	while (!pRing->m_Quit)
+	{
+		pFrame = NULL;
+		for (i = 0; i < pRing->m_Count; i++)
+		{
+			if (pRing->Held(i).save)
+			{
+				pFrame = &pRing->Held(i);
+				break;
+			}
+		}
+		if (pFrame)
+		{
+			// the frame stays in place until save is cleared
+			frame = *pFrame;
+			pthread_mutex_unlock(&pRing->m_Lock);
+			if (!pRing->m_Recorder.Recording())
+			{
+				pRing->m_Recorder.Compress(pRing->m_pCodec != NULL);
+				if (pRing->m_Recorder.Open(pRing->m_EventFile, pRing->m_Width, pRing->m_Height, pRing->m_Bits) != RawRecorder::OK)
+				{
+					// give up on this event
+					pthread_mutex_lock(&pRing->m_Lock);
+					for (i = 0; i < pRing->m_Count; i++)
+						pRing->Held(i).save = false;
+					pRing->m_Saving = false;
+					continue;
+				}
+			}
+			pRing->m_Recorder.Append(pRing->m_pArena + frame.offset, frame.bytes, pRing->m_pCodec != NULL,
+									 frame.sequence, frame.timestamp, frame.exposure);
+			pthread_mutex_lock(&pRing->m_Lock);
+			pFrame->save = false;
+			continue;
+		}
+		if (pRing->m_Saving && (pRing->m_Count > 0)
+			&& (Microseconds(pRing->Held(pRing->m_Count - 1).timestamp) > pRing->m_SaveUntil))
+		{
+			// the post trigger window is over and all of it is written
+			pthread_mutex_unlock(&pRing->m_Lock);
+			pRing->m_Recorder.Close();
+			fprintf(stderr,"Saved %u frames to %s\n", pRing->m_Recorder.Frames(), pRing->m_EventFile.data());
+			pthread_mutex_lock(&pRing->m_Lock);
+			pRing->m_Saving = false;
+			continue;
+		}
+		pthread_cond_wait(&pRing->m_Saveable, &pRing->m_Lock);
+	}
+	pthread_mutex_unlock(&pRing->m_Lock);
+	return NULL;
+}
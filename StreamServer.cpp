@@ -0,0 +1,473 @@
+#include "streamserver.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define STREAM_REQUEST_MAX 4096	// bytes of request headers
+#define STREAM_BOUNDARY "frame"
+
+static const char *s_Types[] = {"image/jpeg", "application/octet-stream"};
+static const char *s_Page =
+	"<html><head><title>CapV4L2</title></head>"
+	"<body style=\"margin:0;background:#000\"><img src=\"/stream.mjpg\" style=\"width:100%\"></body></html>";
+
+StreamServer::StreamServer(int quality)
+	: m_Jpeg(quality, &m_Pool)
+{
+	m_Listen = -1;
+	m_Wake[0] = m_Wake[1] = -1;
+	m_Running = false;
+	m_Quit = false;
+	pthread_mutex_init(&m_Lock, NULL);
+	pthread_cond_init(&m_Posted, NULL);
+	m_Idle = false;
+	m_Want = 0;
+	m_Ready = false;
+	m_Formats = 0;
+	m_Width = m_Height = 0;
+	m_Shift = 8;
+	m_Sequence = 0;
+	for (int f = 0; f < FMT_COUNT; f++)
+	{
+		m_pLatest[f] = NULL;
+		m_Serial[f] = 0;
+	}
+	m_ClientCount = 0;
+	m_Encoded = 0;
+	m_Dropped = 0;
+}
+StreamServer::~StreamServer()
+{
+	Stop();
+	pthread_cond_destroy(&m_Posted);
+	pthread_mutex_destroy(&m_Lock);
+}
+StreamServer::ERR StreamServer::Start(int port)
+{
+	if (m_Running)
+		return OK;
+	m_Listen = socket(AF_INET, SOCK_STREAM, 0);
+	if (m_Listen < 0)
+	{
+		fprintf(stderr,"Error: Creating Stream Socket");
+		return FAIL;
+	}
+	int on = 1;
+	setsockopt(m_Listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if ((bind(m_Listen, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(m_Listen, STREAM_CLIENTS) != 0)
+		|| (pipe(m_Wake) != 0))
+	{
+		fprintf(stderr,"Error: Listening on port %d", port);
+		close(m_Listen);
+		m_Listen = -1;
+		return FAIL;
+	}
+	fcntl(m_Listen, F_SETFL, O_NONBLOCK);
+	fcntl(m_Wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(m_Wake[1], F_SETFL, O_NONBLOCK);
+	m_Quit = false;
+	m_Idle = false;
+	m_Want = 0;
+	m_Ready = false;
+	if (pthread_create(&m_EncoderThread, NULL, EncoderThread, this) != 0)
+	{
+		fprintf(stderr,"Error: Creating Encoder Thread");
+		close(m_Listen);
+		close(m_Wake[0]);
+		close(m_Wake[1]);
+		m_Listen = m_Wake[0] = m_Wake[1] = -1;
+		return FAIL;
+	}
+	if (pthread_create(&m_ServerThread, NULL, ServerThread, this) != 0)
+	{
+		fprintf(stderr,"Error: Creating Server Thread");
+		m_Running = true;
+		Stop();
+		return FAIL;
+	}
+	m_Running = true;
+	fprintf(stderr,"Streaming on http://localhost:%d/\n", port);
+	return OK;
+}
+void StreamServer::Stop()
+{
+	if (!m_Running)
+		return;
+	pthread_mutex_lock(&m_Lock);
+	m_Quit = true;
+	pthread_cond_signal(&m_Posted);
+	pthread_mutex_unlock(&m_Lock);
+	if (write(m_Wake[1], "q", 1) < 0)
+		fprintf(stderr,"Error: Waking Server Thread");
+	pthread_join(m_EncoderThread, NULL);
+	pthread_join(m_ServerThread, NULL);
+	while (!m_Clients.empty())
+		Close(m_Clients.size() - 1);
+	pthread_mutex_lock(&m_Lock);
+	for (int f = 0; f < FMT_COUNT; f++)
+	{
+		if (m_pLatest[f])
+			Release(m_pLatest[f]);
+		m_pLatest[f] = NULL;
+	}
+	pthread_mutex_unlock(&m_Lock);
+	close(m_Listen);
+	close(m_Wake[0]);
+	close(m_Wake[1]);
+	m_Listen = m_Wake[0] = m_Wake[1] = -1;
+	m_Running = false;
+}
+void StreamServer::Post(const cv::Mat &RGB, const uint8_t *raw, int rawLen, int width, int height, uint32_t sequence, int range)
+{
+	// cheap test first, nobody may be watching
+	if (!m_Idle || (m_Want == 0))
+		return;
+	if (pthread_mutex_trylock(&m_Lock) != 0)
+		return;
+	if (m_Idle)
+	{
+		// the capture buffers are reused for the next frame
+		m_Formats = 0;
+		if ((m_Want & (1 << FMT_JPEG)) && !RGB.empty())
+		{
+			RGB.copyTo(m_RGB);
+			// the top 8 of the bits the values use
+			for (m_Shift = 0; (range >> m_Shift) > 256; m_Shift++)
+				;
+			m_Formats |= 1 << FMT_JPEG;
+		}
+		if ((m_Want & (1 << FMT_Y16)) && raw && (rawLen > 0))
+		{
+			m_Raw.assign(raw, raw + rawLen);
+			m_Formats |= 1 << FMT_Y16;
+		}
+		m_Width = width;
+		m_Height = height;
+		m_Sequence = sequence;
+		m_Ready = (m_Formats != 0);
+		m_Idle = !m_Ready;
+		if (m_Ready)
+			pthread_cond_signal(&m_Posted);
+	}
+	pthread_mutex_unlock(&m_Lock);
+}
+
+// ************************************************************************
+// ***************  Private Methods for StreamServer  *********************
+// ************************************************************************
+void *StreamServer::EncoderThread(void *arg)
+{
+	StreamServer *pServer = (StreamServer *)arg;
+	pthread_mutex_lock(&pServer->m_Lock);
+	while (true)
+	{
+		pServer->m_Idle = true;
+		while (!pServer->m_Quit && !pServer->m_Ready)
+			pthread_cond_wait(&pServer->m_Posted, &pServer->m_Lock);
+		if (pServer->m_Quit)
+			break;
+		pServer->m_Ready = false;
+		pthread_mutex_unlock(&pServer->m_Lock);
+
+		// Post() leaves the frame alone until m_Idle is set again
+		pServer->Encode();
+		// a full pipe means the server is already being woken
+		if ((write(pServer->m_Wake[1], "f", 1) < 0) && (errno != EAGAIN))
+			fprintf(stderr,"Error: Waking Server Thread");
+
+		pthread_mutex_lock(&pServer->m_Lock);
+	}
+	pServer->m_Idle = false;
+	pthread_mutex_unlock(&pServer->m_Lock);
+	return NULL;
+}
+void StreamServer::Encode()
+{
+	char part[256];
+	char headers[128];
+	PACKET *pPacket;
+	std::vector<unsigned char> &jpeg = m_JpegBytes;
+	const uint8_t *pPayload;
+	size_t bytes;
+	for (int f = 0; f < FMT_COUNT; f++)
+	{
+		if ((m_Formats & (1 << f)) == 0)
+			continue;
+		if (f == FMT_JPEG)
+		{
+			// strips in parallel, 16 bit planes from the top 8 of their bits
+			m_Jpeg.SetShift(m_Shift);
+			if (m_Jpeg.Encode(m_RGB, jpeg) != JpegEncoder::OK)
+				continue;
+			pPayload = &jpeg[0];
+			bytes = jpeg.size();
+		}
+		else
+		{
+			pPayload = &m_Raw[0];
+			bytes = m_Raw.size();
+		}
+		// each part is complete in the packet, a client sends it whole
+		snprintf(headers, sizeof(headers), "X-Width: %d\r\nX-Height: %d\r\nX-Sequence: %u\r\n", m_Width, m_Height, m_Sequence);
+		snprintf(part, sizeof(part), "--" STREAM_BOUNDARY "\r\nContent-Type: %s\r\nContent-Length: %lu\r\n%s\r\n",
+				 s_Types[f], (unsigned long)bytes, headers);
+		pPacket = new PACKET;
+		size_t partBytes = strlen(part);
+		pPacket->data.resize(partBytes + bytes + 2);
+		memcpy(&pPacket->data[0], part, partBytes);
+		memcpy(&pPacket->data[partBytes], pPayload, bytes);
+		memcpy(&pPacket->data[partBytes + bytes], "\r\n", 2);
+		pPacket->payload = partBytes;
+		pPacket->payloadBytes = bytes;
+		pPacket->headers = headers;
+		pPacket->refs = 1;
+		Publish(f, pPacket);
+	}
+	m_Encoded++;
+}
+void StreamServer::Publish(int format, PACKET *pPacket)
+{
+	pthread_mutex_lock(&m_Lock);
+	pPacket->serial = ++m_Serial[format];
+	if (m_pLatest[format])
+		Release(m_pLatest[format]);
+	m_pLatest[format] = pPacket;
+	pthread_mutex_unlock(&m_Lock);
+}
+void StreamServer::Release(PACKET *pPacket)
+{
+	if (--pPacket->refs == 0)
+		delete pPacket;
+}
+void *StreamServer::ServerThread(void *arg)
+{
+	((StreamServer *)arg)->Serve();
+	return NULL;
+}
+void StreamServer::Serve()
+{
+	std::vector<struct pollfd> fds;
+	struct pollfd pfd;
+	char drain[64];
+	size_t i;
+	int want;
+	while (!m_Quit)
+	{
+		fds.clear();
+		pfd.fd = m_Listen;
+		pfd.events = (m_Clients.size() < STREAM_CLIENTS) ? POLLIN : 0;
+		fds.push_back(pfd);
+		pfd.fd = m_Wake[0];
+		pfd.events = POLLIN;
+		fds.push_back(pfd);
+		want = 0;
+		for (i = 0; i < m_Clients.size(); i++)
+		{
+			pfd.fd = m_Clients[i].fd;
+			// reading the request, or watching for a hang up while there is nothing to send
+			pfd.events = POLLIN;
+			if (!m_Clients[i].reading)
+			{
+				want |= 1 << m_Clients[i].format;
+				if (Pending(m_Clients[i]))
+					pfd.events |= POLLOUT;
+			}
+			fds.push_back(pfd);
+		}
+		m_Want = want;
+		if (poll(&fds[0], fds.size(), -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr,"Error: Stream poll %d", errno);
+			break;
+		}
+		if (fds[1].revents & POLLIN)
+		{
+			while (read(m_Wake[0], drain, sizeof(drain)) > 0)
+				;
+		}
+		// back to front so closing one does not move those still to be done
+		for (i = m_Clients.size(); i-- > 0;)
+		{
+			short revents = fds[i + 2].revents;
+			if (revents & (POLLERR | POLLNVAL))
+				Close(i);
+			else if ((revents & (POLLIN | POLLHUP)) && !Receive(m_Clients[i]))
+				Close(i);
+			else if ((revents & POLLOUT) && !Send(m_Clients[i]))
+				Close(i);
+		}
+		if (fds[0].revents & POLLIN)
+			Accept();
+		m_ClientCount = m_Clients.size();
+	}
+}
+void StreamServer::Accept()
+{
+	int fd;
+	int on = 1;
+	CLIENT client;
+	while ((m_Clients.size() < STREAM_CLIENTS) && ((fd = accept(m_Listen, NULL, NULL)) >= 0))
+	{
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		client.fd = fd;
+		client.request.clear();
+		client.reading = true;
+		client.head.clear();
+		client.headSent = 0;
+		client.format = FMT_JPEG;
+		client.once = false;
+		client.pPacket = NULL;
+		client.sent = client.end = 0;
+		client.serial = 0;
+		client.any = false;
+		m_Clients.push_back(client);
+	}
+}
+bool StreamServer::Receive(CLIENT &client)
+{
+	char buf[1024];
+	ssize_t n = recv(client.fd, buf, sizeof(buf), 0);
+	if (n == 0)
+		return false;	// hung up
+	if (n < 0)
+		return (errno == EAGAIN) || (errno == EINTR);
+	if (!client.reading)
+		return true;	// nothing more is expected once streaming
+	client.request.append(buf, n);
+	if (client.request.find("\r\n\r\n") == std::string::npos)
+		return client.request.size() < STREAM_REQUEST_MAX;
+	client.reading = false;
+	char path[256] = "";
+	sscanf(client.request.c_str(), "GET %255s", path);
+	client.request.clear();
+	if ((strcmp(path, "/") == 0) || (strcmp(path, "/index.html") == 0))
+	{
+		char head[128];
+		snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\nContent-Length: %lu\r\n\r\n",
+				 (unsigned long)strlen(s_Page));
+		client.head = std::string(head) + s_Page;
+		client.format = FMT_COUNT;	// no frames, closed once the page is sent
+		client.once = true;
+		return true;
+	}
+	std::string name = path;
+	client.format = (name.find(".y16") != std::string::npos) ? FMT_Y16 : FMT_JPEG;
+	if ((name == "/stream.mjpg") || (name == "/stream.y16"))
+	{
+		client.head = "HTTP/1.0 200 OK\r\nCache-Control: no-cache\r\nConnection: close\r\n"
+					  "Content-Type: multipart/x-mixed-replace; boundary=" STREAM_BOUNDARY "\r\n\r\n";
+		client.once = false;
+	}
+	else if ((name == "/frame.jpg") || (name == "/frame.y16"))
+		client.once = true;	// headers go with the frame
+	else
+	{
+		client.head = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+		client.format = FMT_COUNT;
+		client.once = true;
+	}
+	return true;
+}
+bool StreamServer::Pending(CLIENT &client)
+{
+	if (client.headSent < client.head.size())
+		return true;
+	if (client.format == FMT_COUNT)
+		return false;
+	if (client.pPacket && (client.sent < client.end))
+		return true;
+	// a newer packet than the last one taken, the encoder may replace it meanwhile
+	pthread_mutex_lock(&m_Lock);
+	bool newer = m_pLatest[client.format] && (!client.any || (m_Serial[client.format] != client.serial));
+	pthread_mutex_unlock(&m_Lock);
+	return newer;
+}
+bool StreamServer::Take(CLIENT &client)
+{
+	pthread_mutex_lock(&m_Lock);
+	PACKET *pPacket = m_pLatest[client.format];
+	if ((pPacket == NULL) || (client.any && (pPacket->serial == client.serial)))
+	{
+		pthread_mutex_unlock(&m_Lock);
+		return false;
+	}
+	if (client.any)
+		m_Dropped += pPacket->serial - client.serial - 1;
+	pPacket->refs++;
+	if (client.pPacket)
+		Release(client.pPacket);
+	pthread_mutex_unlock(&m_Lock);
+	client.pPacket = pPacket;
+	client.serial = pPacket->serial;
+	client.any = true;
+	if (client.once)
+	{
+		// a single frame is a plain response of just the payload
+		char head[256];
+		snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nCache-Control: no-cache\r\nContent-Type: %s\r\nContent-Length: %lu\r\n%s\r\n",
+				 s_Types[client.format], (unsigned long)pPacket->payloadBytes, pPacket->headers.c_str());
+		client.head = head;
+		client.headSent = 0;
+		client.sent = pPacket->payload;
+		client.end = pPacket->payload + pPacket->payloadBytes;
+	}
+	else
+	{
+		client.sent = 0;
+		client.end = pPacket->data.size();
+	}
+	return true;
+}
+bool StreamServer::Send(CLIENT &client)
+{
+	ssize_t n;
+	while (true)
+	{
+		if (client.headSent < client.head.size())
+		{
+			n = send(client.fd, client.head.data() + client.headSent, client.head.size() - client.headSent, MSG_NOSIGNAL);
+			if (n < 0)
+				return (errno == EAGAIN) || (errno == EINTR);
+			client.headSent += n;
+			continue;
+		}
+		if (client.pPacket && (client.sent < client.end))
+		{
+			n = send(client.fd, &client.pPacket->data[client.sent], client.end - client.sent, MSG_NOSIGNAL);
+			if (n < 0)
+				return (errno == EAGAIN) || (errno == EINTR);
+			client.sent += n;
+			continue;
+		}
+		// everything taken has gone
+		if (client.once && (client.any || (client.format == FMT_COUNT)))
+			return false;
+		if ((client.format == FMT_COUNT) || !Take(client))
+			return true;
+	}
+}
+void StreamServer::Close(size_t i)
+{
+	CLIENT &client = m_Clients[i];
+	close(client.fd);
+	if (client.pPacket)
+	{
+		pthread_mutex_lock(&m_Lock);
+		Release(client.pPacket);
+		pthread_mutex_unlock(&m_Lock);
+	}
+	m_Clients.erase(m_Clients.begin() + i);
+}
@@ -0,0 +1,164 @@
+#include "temporalfilter.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+TemporalFilter::TemporalFilter(int bits)
+{
+	m_Enabled = false;
+	m_Bits16 = (bits > 15) ? 15 : bits;
+	m_Frac = 0;
+	m_Prepared = false;
+	for (int c = 0; c < TEMPORAL_MAX_CHANNELS; c++)
+	{
+		m_Alpha[c] = 0.25F;
+		m_Threshold[c] = 1 << (m_Bits16 - 4);	// 1/16 of full scale
+	}
+}
+TemporalFilter::~TemporalFilter()
+{
+}
+void TemporalFilter::SetChannel(int channel, float alpha, int threshold)
+{
+	if ((channel < 0) || (channel >= TEMPORAL_MAX_CHANNELS))
+		return;
+	m_Alpha[channel] = alpha;
+	m_Threshold[channel] = threshold;
+	m_Prepared = false;
+}
+
+#ifdef __SSE2__
+// one 8 lane step of the filter, returns the filtered output
+static inline __m128i TemporalStep(__m128i in, unsigned short *pAcc, __m128i w, __m128i thr, __m128i frac, __m128i round)
+{
+	__m128i inS = _mm_sll_epi16(in, frac);
+	__m128i acc = _mm_loadu_si128((__m128i *)pAcc);
+	__m128i diff = _mm_sub_epi16(inS, acc);
+	__m128i absd = _mm_max_epi16(diff, _mm_sub_epi16(_mm_setzero_si128(), diff));
+	__m128i moved = _mm_cmpgt_epi16(absd, thr);
+	__m128i upd = _mm_add_epi16(acc, _mm_mulhi_epi16(diff, w));
+	acc = _mm_or_si128(_mm_and_si128(moved, inS), _mm_andnot_si128(moved, upd));
+	_mm_storeu_si128((__m128i *)pAcc, acc);
+	return _mm_srl_epi16(_mm_add_epi16(acc, round), frac);
+}
+#endif
+
+TemporalFilter::ERR TemporalFilter::Apply(cv::Mat &plane)
+{
+	if (!m_Enabled)
+		return OK;
+	int depth = plane.depth();
+	int cn = plane.channels();
+	if (((depth != CV_8U) && (depth != CV_16U)) || (cn > TEMPORAL_MAX_CHANNELS) || (cn == 2))
+	{
+		fprintf(stderr,"Error: Temporal filter plane type not supported");
+		return FAIL;
+	}
+	int width = plane.cols * cn;
+	int height = plane.rows;
+	int i, j;
+	bool restart = m_Acc.empty() || (m_Acc.size() != plane.size()) || (m_Acc.channels() != cn)
+		|| (m_Frac != 15 - ((depth == CV_8U) ? 8 : m_Bits16));
+	if (restart || !m_Prepared)
+		Prepare(plane.type());
+	if (restart)
+	{
+		// first frame just primes the accumulator
+		m_Acc.create(plane.size(), CV_MAKETYPE(CV_16U, cn));
+		for (i = 0; i < height; i++)
+		{
+			unsigned short *pAcc = (unsigned short *)m_Acc.ptr(i);
+			if (depth == CV_8U)
+			{
+				unsigned char *pSrc = plane.ptr(i);
+				for (j = 0; j < width; j++)
+					pAcc[j] = (unsigned short)(pSrc[j] << m_Frac);
+			}
+			else
+			{
+				unsigned short *pSrc = (unsigned short *)plane.ptr(i);
+				for (j = 0; j < width; j++)
+					pAcc[j] = (unsigned short)(pSrc[j] << m_Frac);
+			}
+		}
+		return OK;
+	}
+	int round = 1 << m_Frac >> 1;
+	int inS, diff, acc, lane;
+	for (i = 0; i < height; i++)
+	{
+		unsigned short *pAcc = (unsigned short *)m_Acc.ptr(i);
+		unsigned char *pSrc8 = plane.ptr(i);
+		unsigned short *pSrc16 = (unsigned short *)plane.ptr(i);
+		j = 0;
+#ifdef __SSE2__
+		__m128i vfrac = _mm_cvtsi32_si128(m_Frac);
+		__m128i vround = _mm_set1_epi16((short)round);
+		__m128i w[3], thr[3], zero = _mm_setzero_si128();
+		for (int k = 0; k < 3; k++)
+		{
+			w[k] = _mm_loadu_si128((__m128i *)&m_LaneWeight[8 * k]);
+			thr[k] = _mm_loadu_si128((__m128i *)&m_LaneThreshold[8 * k]);
+		}
+		// 24 elements at a time so the lane pattern repeats for 1 or 3 channels
+		for (; j + 24 <= width; j += 24)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				int o = j + 8 * k;
+				if (depth == CV_8U)
+				{
+					__m128i in = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)&pSrc8[o]), zero);
+					__m128i out = TemporalStep(in, &pAcc[o], w[k], thr[k], vfrac, vround);
+					_mm_storel_epi64((__m128i *)&pSrc8[o], _mm_packus_epi16(out, out));
+				}
+				else
+				{
+					__m128i in = _mm_loadu_si128((__m128i *)&pSrc16[o]);
+					__m128i out = TemporalStep(in, &pAcc[o], w[k], thr[k], vfrac, vround);
+					_mm_storeu_si128((__m128i *)&pSrc16[o], out);
+				}
+			}
+		}
+#endif
+		// same arithmetic as the vector kernel for the rest of the row
+		for (; j < width; j++)
+		{
+			lane = j % 24;
+			inS = ((depth == CV_8U) ? pSrc8[j] : pSrc16[j]) << m_Frac;
+			acc = pAcc[j];
+			diff = inS - acc;
+			if (((diff < 0) ? -diff : diff) > m_LaneThreshold[lane])
+				acc = inS;
+			else
+				acc += (diff * m_LaneWeight[lane]) >> 16;
+			pAcc[j] = (unsigned short)acc;
+			if (depth == CV_8U)
+				pSrc8[j] = (unsigned char)((acc + round) >> m_Frac);
+			else
+				pSrc16[j] = (unsigned short)((acc + round) >> m_Frac);
+		}
+	}
+	return OK;
+}
+
+// ************************************************************************
+// ***************  Protected Methods for TemporalFilter  *****************
+// ************************************************************************
+void TemporalFilter::Prepare(int type)
+{
+	int cn = CV_MAT_CN(type);
+	// the accumulator keeps the input in the low 15 bits so differences fit a short
+	m_Frac = 15 - ((CV_MAT_DEPTH(type) == CV_8U) ? 8 : m_Bits16);
+	int c, w, t;
+	for (int lane = 0; lane < 24; lane++)
+	{
+		c = lane % cn;
+		w = (int)(m_Alpha[c] * 65536.0F + 0.5F);
+		w = (w < 1) ? 1 : ((w > 32767) ? 32767 : w);
+		t = m_Threshold[c] << m_Frac;
+		m_LaneWeight[lane] = (short)w;
+		m_LaneThreshold[lane] = (short)((m_Threshold[c] <= 0) ? -1 : ((t > 32767) ? 32767 : t));
+	}
+	m_Prepared = true;
+}
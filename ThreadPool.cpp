@@ -0,0 +1,138 @@
+#include "threadpool.h"
+#include <stdio.h>
+#include <unistd.h>
+
+static ThreadPool *s_pShared = NULL;
+static pthread_once_t s_SharedOnce = PTHREAD_ONCE_INIT;
+static void CreateShared()
+{
+	s_pShared = new ThreadPool();
+}
+
+ThreadPool::ThreadPool(int threads)
+{
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	m_Threads = (threads < 1) ? 1 : threads;
+	pthread_mutex_init(&m_RunLock, NULL);
+	pthread_mutex_init(&m_Lock, NULL);
+	pthread_cond_init(&m_Start, NULL);
+	pthread_cond_init(&m_Done, NULL);
+	m_Task = NULL;
+	m_Arg = NULL;
+	m_Count = 0;
+	m_Next = 0;
+	m_Finished = 0;
+	m_Active = 0;
+	m_Generation = 0;
+	m_Quit = false;
+	// the caller is one of the threads
+	pthread_t thread;
+	for (int i = 1; i < m_Threads; i++)
+	{
+		if (pthread_create(&thread, NULL, Worker, this) != 0)
+		{
+			fprintf(stderr,"Error: Creating Worker Thread");
+			break;
+		}
+		m_Workers.push_back(thread);
+	}
+	m_Threads = (int)m_Workers.size() + 1;
+}
+ThreadPool::~ThreadPool()
+{
+	pthread_mutex_lock(&m_Lock);
+	m_Quit = true;
+	pthread_cond_broadcast(&m_Start);
+	pthread_mutex_unlock(&m_Lock);
+	for (size_t i = 0; i < m_Workers.size(); i++)
+		pthread_join(m_Workers[i], NULL);
+	pthread_cond_destroy(&m_Done);
+	pthread_cond_destroy(&m_Start);
+	pthread_mutex_destroy(&m_Lock);
+	pthread_mutex_destroy(&m_RunLock);
+}
+ThreadPool *ThreadPool::Shared()
+{
+	pthread_once(&s_SharedOnce, CreateShared);
+	return s_pShared;
+}
+void ThreadPool::Run(TASK task, void *arg, int count)
+{
+	if (count <= 0)
+		return;
+	if ((count == 1) || m_Workers.empty())
+	{
+		for (int i = 0; i < count; i++)
+			task(arg, i);
+		return;
+	}
+	pthread_mutex_lock(&m_RunLock);
+	pthread_mutex_lock(&m_Lock);
+	m_Task = task;
+	m_Arg = arg;
+	m_Count = count;
+	m_Next = 0;
+	m_Finished = 0;
+	m_Generation++;
+	pthread_cond_broadcast(&m_Start);
+	pthread_mutex_unlock(&m_Lock);
+
+	int done = Work(task, arg, count);
+
+	// wait for the parts still running and for every worker to leave this job
+	// so none of them can pick up a part of the next one
+	pthread_mutex_lock(&m_Lock);
+	m_Finished += done;
+	while ((m_Finished < count) || (m_Active > 0))
+		pthread_cond_wait(&m_Done, &m_Lock);
+	m_Task = NULL;
+	pthread_mutex_unlock(&m_Lock);
+	pthread_mutex_unlock(&m_RunLock);
+}
+
+// ************************************************************************
+// ***************  Private Methods for ThreadPool  ***********************
+// ************************************************************************
+void *ThreadPool::Worker(void *arg)
+{
+	ThreadPool *pPool = (ThreadPool *)arg;
+	unsigned int seen = 0;
+	TASK task;
+	void *taskArg;
+	int count, done;
+	pthread_mutex_lock(&pPool->m_Lock);
+	while (true)
+	{
+		while (!pPool->m_Quit && ((seen == pPool->m_Generation) || (pPool->m_Task == NULL)))
+			pthread_cond_wait(&pPool->m_Start, &pPool->m_Lock);
+		if (pPool->m_Quit)
+			break;
+		seen = pPool->m_Generation;
+		task = pPool->m_Task;
+		taskArg = pPool->m_Arg;
+		count = pPool->m_Count;
+		pPool->m_Active++;
+		pthread_mutex_unlock(&pPool->m_Lock);
+
+		done = pPool->Work(task, taskArg, count);
+
+		pthread_mutex_lock(&pPool->m_Lock);
+		pPool->m_Finished += done;
+		pPool->m_Active--;
+		pthread_cond_signal(&pPool->m_Done);
+	}
+	pthread_mutex_unlock(&pPool->m_Lock);
+	return NULL;
+}
+int ThreadPool::Work(TASK task, void *arg, int count)
+{
+	int done = 0;
+	int part;
+	while ((part = __sync_fetch_and_add(&m_Next, 1)) < count)
+	{
+		task(arg, part);
+		done++;
+	}
+	return done;
+}
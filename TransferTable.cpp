@@ -0,0 +1,221 @@
+#include "transfertable.h"
+#include <math.h>
+#include <pthread.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+// process wide cache of built tables, they live until the process exits
+static std::vector<TransferTable *> s_Cache;
+static pthread_mutex_t s_CacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+TransferTable::TransferTable()
+{
+	m_Curve = CURVE_LINEAR;
+	m_Range = 0;
+	m_OutputBits = 0;
+	m_Shift = 0; m_Mask = 0; m_Round = 0;
+	m_pTable = NULL;
+}
+TransferTable::~TransferTable()
+{
+}
+const TransferTable *TransferTable::Get(CURVE curve, int inputRange, int outputBits)
+{
+	TransferTable *pTable = NULL;
+	if (curve == CURVE_USER)
+		return NULL;
+	pthread_mutex_lock(&s_CacheLock);
+	for (size_t i = 0; i < s_Cache.size(); i++)
+	{
+		if (s_Cache[i]->Matches(curve, inputRange, outputBits))
+		{
+			pTable = s_Cache[i];
+			break;
+		}
+	}
+	if (pTable == NULL)
+	{
+		pTable = new TransferTable();
+		if (pTable->Build(curve, inputRange, outputBits) == OK)
+			s_Cache.push_back(pTable);
+		else
+		{
+			delete pTable;
+			pTable = NULL;
+		}
+	}
+	pthread_mutex_unlock(&s_CacheLock);
+	return pTable;
+}
+double TransferTable::Evaluate(CURVE curve, double x)
+{
+	x = (x < 0.0) ? 0.0 : ((x > 1.0) ? 1.0 : x);
+	switch (curve)
+	{
+	case CURVE_SRGB:
+		if (x < 0.0031308)
+			return 12.92 * x;
+		return 1.055 * pow(x, 1.0 / 2.4) - 0.055;
+	case CURVE_REC709:
+		if (x < 0.018)
+			return 4.5 * x;
+		return 1.099 * pow(x, 0.45) - 0.099;
+	case CURVE_LOG:
+		return log(1.0 + 255.0 * x) / log(256.0);
+	case CURVE_LINEAR:
+	default:
+		return x;
+	}
+}
+TransferTable::ERR TransferTable::BuildUser(const float *points, int n, int inputRange, int outputBits)
+{
+	if ((points == NULL) || (n < 2))
+	{
+		fprintf(stderr,"Error: User curve needs at least 2 points");
+		return FAIL;
+	}
+	m_Curve = CURVE_USER;
+	m_Points.assign(points, points + n);
+	return Fill(inputRange, outputBits);
+}
+TransferTable::ERR TransferTable::Build(CURVE curve, int inputRange, int outputBits)
+{
+	if (curve == CURVE_USER)
+	{
+		fprintf(stderr,"Error: User curves are built with BuildUser()");
+		return FAIL;
+	}
+	m_Curve = curve;
+	m_Points.clear();
+	return Fill(inputRange, outputBits);
+}
+
+#ifdef __x86_64__
+// AVX2 paths for 16 bit input, chosen at run time so the build does not need -mavx2.
+// A 32 bit gather at 16 bit scale fetches entry i in the low half and,
+// for knot tables, knot i + 1 in the high half for the interpolation.
+static bool HasAVX2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+static const bool s_AVX2 = HasAVX2();
+
+__attribute__((target("avx2")))
+static int ApplyDirectAVX2(const unsigned short *pTable, int last, const unsigned short *src, unsigned short *dst, int n)
+{
+	__m128i vlast = _mm_set1_epi16((short)last);
+	__m256i low = _mm256_set1_epi32(0xffff);
+	int j;
+	for (j = 0; j + 8 <= n; j += 8)
+	{
+		__m128i s = _mm_min_epu16(_mm_loadu_si128((const __m128i *)&src[j]), vlast);
+		__m256i v = _mm256_i32gather_epi32((const int *)pTable, _mm256_cvtepu16_epi32(s), 2);
+		v = _mm256_and_si256(v, low);
+		_mm_storeu_si128((__m128i *)&dst[j],
+			_mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+	}
+	return j;
+}
+__attribute__((target("avx2")))
+static int ApplyKnotsAVX2(const unsigned short *pTable, int last, int shift, const unsigned short *src, unsigned short *dst, int n)
+{
+	__m128i vlast = _mm_set1_epi16((short)last);
+	__m256i low = _mm256_set1_epi32(0xffff);
+	__m256i mask = _mm256_set1_epi32((1 << shift) - 1);
+	__m256i round = _mm256_set1_epi32((1 << shift) >> 1);
+	__m128i vshift = _mm_cvtsi32_si128(shift);
+	int j;
+	for (j = 0; j + 8 <= n; j += 8)
+	{
+		__m128i s = _mm_min_epu16(_mm_loadu_si128((const __m128i *)&src[j]), vlast);
+		__m256i v = _mm256_cvtepu16_epi32(s);
+		__m256i f = _mm256_and_si256(v, mask);
+		__m256i k = _mm256_i32gather_epi32((const int *)pTable, _mm256_srl_epi32(v, vshift), 2);
+		__m256i k0 = _mm256_and_si256(k, low);
+		__m256i k1 = _mm256_srli_epi32(k, 16);
+		__m256i d = _mm256_mullo_epi32(_mm256_sub_epi32(k1, k0), f);
+		v = _mm256_add_epi32(k0, _mm256_sra_epi32(_mm256_add_epi32(d, round), vshift));
+		_mm_storeu_si128((__m128i *)&dst[j],
+			_mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+	}
+	return j;
+}
+#endif
+
+void TransferTable::Apply(const unsigned short *src, unsigned short *dst, int n) const
+{
+	int j = 0;
+	int last = m_Range - 1;
+#ifdef __x86_64__
+	if (s_AVX2)
+		j = (m_Shift == 0) ? ApplyDirectAVX2(m_pTable, last, src, dst, n)
+						   : ApplyKnotsAVX2(m_pTable, last, m_Shift, src, dst, n);
+#endif
+	if (m_Shift == 0)
+	{
+		for (; j < n; j++)
+			dst[j] = m_pTable[(src[j] < last) ? src[j] : last];
+		return;
+	}
+	for (; j < n; j++)
+		dst[j] = (unsigned short)Lookup(src[j]);
+}
+void TransferTable::Apply(const unsigned char *src, unsigned char *dst, int n) const
+{
+	int j;
+	if ((m_Shift == 0) && (m_Range >= 256))
+	{
+		for (j = 0; j < n; j++)
+			dst[j] = (unsigned char)m_pTable[src[j]];
+		return;
+	}
+	for (j = 0; j < n; j++)
+		dst[j] = (unsigned char)Lookup(src[j]);
+}
+
+// ************************************************************************
+// ***************  Private Methods for TransferTable  ********************
+// ************************************************************************
+double TransferTable::Value(double x)
+{
+	if (m_Curve != CURVE_USER)
+		return Evaluate(m_Curve, x);
+	x = (x < 0.0) ? 0.0 : ((x > 1.0) ? 1.0 : x);
+	double pos = x * (m_Points.size() - 1);
+	int i = (int)pos;
+	if (i >= (int)m_Points.size() - 1)
+		return m_Points.back();
+	return m_Points[i] + (pos - i) * (m_Points[i + 1] - m_Points[i]);
+}
+TransferTable::ERR TransferTable::Fill(int inputRange, int outputBits)
+{
+	if ((inputRange < 2) || (inputRange > 65536) || (outputBits < 1) || (outputBits > 16))
+	{
+		fprintf(stderr,"Error: Transfer table %d codes to %d bits not supported", inputRange, outputBits);
+		return FAIL;
+	}
+	m_Range = inputRange;
+	m_OutputBits = outputBits;
+	m_Shift = 0;
+	while ((inputRange >> m_Shift) > TRANSFER_DIRECT_MAX)
+		m_Shift++;
+	m_Mask = (1 << m_Shift) - 1;
+	m_Round = (1 << m_Shift) >> 1;
+	// direct tables have an entry per code, knot tables one past the last segment
+	int entries = (m_Shift == 0) ? inputRange : ((inputRange - 1) >> m_Shift) + 2;
+	double scale = (double)(1 << outputBits);
+	int top = (1 << outputBits) - 1;
+	int v;
+	// one spare entry so 32 bit gathers of the last entry stay inside the table
+	m_Table.resize(entries + 1);
+	for (int i = 0; i < entries; i++)
+	{
+		v = (int)(scale * Value((double)(i << m_Shift) / inputRange));
+		m_Table[i] = (unsigned short)((v < 0) ? 0 : ((v > top) ? top : v));
+	}
+	m_Table[entries] = m_Table[entries - 1];
+	m_pTable = &m_Table[0];
+	return OK;
+}
@@ -0,0 +1,171 @@
+// the encoder writes through highgui, HEADLESS builds leave it out
+#ifndef HEADLESS
+#include "videoencoder.h"
+#include <string.h>
+#include <sys/time.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+static double Milliseconds()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e3 + tv.tv_usec * 1e-3;
+}
+
+VideoEncoder::VideoEncoder(int slots, POLICY policy)
+{
+	m_Policy = policy;
+	m_Slots.resize((slots < 1) ? 1 : slots);
+	m_Head = m_Count = 0;
+	m_pWriter = NULL;
+	m_Running = false;
+	m_Quit = false;
+	pthread_mutex_init(&m_Lock, NULL);
+	pthread_cond_init(&m_Queued, NULL);
+	pthread_cond_init(&m_Space, NULL);
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_EncodeMs = 0.0;
+}
+VideoEncoder::~VideoEncoder()
+{
+	Close();
+	pthread_cond_destroy(&m_Space);
+	pthread_cond_destroy(&m_Queued);
+	pthread_mutex_destroy(&m_Lock);
+}
+VideoEncoder::ERR VideoEncoder::Open(std::string fileName, int fourcc, double fps, cv::Size frameSize, int type, bool isColor)
+{
+	Close();
+	m_pWriter = new cv::VideoWriter();
+	if (!m_pWriter->open(fileName, fourcc, fps, frameSize, isColor))
+	{
+		fprintf(stderr,"Error: Opening video %s", fileName.data());
+		delete m_pWriter;
+		m_pWriter = NULL;
+		return FAIL;
+	}
+	// slots are allocated now for frames of the output size, Push() only fills
+	// them, and take the size of larger frames once at the first one
+	for (size_t i = 0; i < m_Slots.size(); i++)
+		m_Slots[i].create(frameSize, type);
+	m_FrameSize = frameSize;
+	m_Scaled.create(frameSize, type);
+	m_Head = m_Count = 0;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_EncodeMs = 0.0;
+	m_Quit = false;
+	if (pthread_create(&m_Thread, NULL, Thread, this) != 0)
+	{
+		fprintf(stderr,"Error: Creating Encoder Thread");
+		delete m_pWriter;
+		m_pWriter = NULL;
+		return FAIL;
+	}
+	m_Running = true;
+	return OK;
+}
+void VideoEncoder::Close()
+{
+	if (!m_Running)
+		return;
+	pthread_mutex_lock(&m_Lock);
+	m_Quit = true;
+	pthread_cond_signal(&m_Queued);
+	pthread_mutex_unlock(&m_Lock);
+	pthread_join(m_Thread, NULL);
+	m_Running = false;
+	m_pWriter->release();
+	delete m_pWriter;
+	m_pWriter = NULL;
+}
+VideoEncoder::ERR VideoEncoder::Push(const cv::Mat &frame)
+{
+	if (!m_Running)
+		return FAIL;
+	int slots = (int)m_Slots.size();
+	pthread_mutex_lock(&m_Lock);
+	if (m_Count == slots)
+	{
+		if (m_Policy == ENCODE_DROP)
+		{
+			m_Stats.dropped++;
+			pthread_mutex_unlock(&m_Lock);
+			return FAIL;
+		}
+		m_Stats.blocked++;
+		double start = Milliseconds();
+		while (m_Count == slots)
+			pthread_cond_wait(&m_Space, &m_Lock);
+		m_Stats.blockedMs += (float)(Milliseconds() - start);
+	}
+	cv::Mat &slot = m_Slots[(m_Head + m_Count) % slots];
+	pthread_mutex_unlock(&m_Lock);
+
+	// the tail slot is not queued yet so the writer leaves it alone
+	frame.copyTo(slot);
+
+	pthread_mutex_lock(&m_Lock);
+	m_Count++;
+	m_Stats.depthMax = (m_Count > m_Stats.depthMax) ? m_Count : m_Stats.depthMax;
+	pthread_cond_signal(&m_Queued);
+	pthread_mutex_unlock(&m_Lock);
+	return OK;
+}
+void VideoEncoder::Stats(ENCODE_STATS &stats)
+{
+	pthread_mutex_lock(&m_Lock);
+	stats = m_Stats;
+	stats.encodeMs = m_Stats.frames ? (float)(m_EncodeMs / m_Stats.frames) : 0.0F;
+	stats.depth = m_Count;
+	pthread_mutex_unlock(&m_Lock);
+}
+void VideoEncoder::PrintStats()
+{
+	ENCODE_STATS stats;
+	Stats(stats);
+	fprintf(stderr,"Encoded %u frames %5.2f ms mean %5.2f ms max, queue %d max %d, dropped %u, blocked %u for %5.1f ms\n",
+			stats.frames, stats.encodeMs, stats.encodeMsMax, stats.depth, stats.depthMax,
+			stats.dropped, stats.blocked, stats.blockedMs);
+}
+
+// ************************************************************************
+// ***************  Private Methods for VideoEncoder  *********************
+// ************************************************************************
+void *VideoEncoder::Thread(void *arg)
+{
+	VideoEncoder *pEncoder = (VideoEncoder *)arg;
+	double start, ms;
+	pthread_mutex_lock(&pEncoder->m_Lock);
+	while (true)
+	{
+		while (!pEncoder->m_Quit && (pEncoder->m_Count == 0))
+			pthread_cond_wait(&pEncoder->m_Queued, &pEncoder->m_Lock);
+		// the queue is written out before quitting
+		if (pEncoder->m_Count == 0)
+			break;
+		cv::Mat &slot = pEncoder->m_Slots[pEncoder->m_Head];
+		pthread_mutex_unlock(&pEncoder->m_Lock);
+
+		start = Milliseconds();
+		if (slot.size() == pEncoder->m_FrameSize)
+			pEncoder->m_pWriter->write(slot);
+		else
+		{
+			cv::resize(slot, pEncoder->m_Scaled, pEncoder->m_FrameSize, 0, 0, CV_INTER_NN);
+			pEncoder->m_pWriter->write(pEncoder->m_Scaled);
+		}
+		ms = Milliseconds() - start;
+
+		pthread_mutex_lock(&pEncoder->m_Lock);
+		pEncoder->m_Head = (pEncoder->m_Head + 1) % (int)pEncoder->m_Slots.size();
+		pEncoder->m_Count--;
+		pEncoder->m_Stats.frames++;
+		pEncoder->m_EncodeMs += ms;
+		pEncoder->m_Stats.encodeMsMax = ((float)ms > pEncoder->m_Stats.encodeMsMax) ? (float)ms : pEncoder->m_Stats.encodeMsMax;
+		pthread_cond_signal(&pEncoder->m_Space);
+	}
+	pthread_mutex_unlock(&pEncoder->m_Lock);
+	return NULL;
+}
+#endif // HEADLESS
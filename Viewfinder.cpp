@@ -0,0 +1,141 @@
+// the viewfinder needs highgui, HEADLESS builds leave it out
+#ifndef HEADLESS
+#include "viewfinder.h"
+#include <sys/time.h>
+#include <vector>
+#include <opencv2/highgui/highgui.hpp>
+
+Viewfinder::Viewfinder(int refreshHz)
+{
+	pthread_mutex_init(&m_Lock, NULL);
+	m_Running = false;
+	m_Quit = false;
+	m_Wanted = false;
+	m_Ready = false;
+	m_Shown = 0;
+	SetRefresh(refreshHz);
+}
+Viewfinder::~Viewfinder()
+{
+	Stop();
+	pthread_mutex_destroy(&m_Lock);
+}
+Viewfinder::ERR Viewfinder::Start()
+{
+	if (m_Running)
+		return OK;
+	m_Quit = false;
+	m_Wanted = false;
+	m_Ready = false;
+	if (pthread_create(&m_Thread, NULL, Thread, this) != 0)
+	{
+		fprintf(stderr,"Error: Creating Viewfinder Thread");
+		return FAIL;
+	}
+	m_Running = true;
+	return OK;
+}
+void Viewfinder::Stop()
+{
+	if (!m_Running)
+		return;
+	m_Quit = true;
+	pthread_join(m_Thread, NULL);
+	m_Running = false;
+}
+void Viewfinder::SetRefresh(int refreshHz)
+{
+	refreshHz = (refreshHz < 1) ? 1 : ((refreshHz > 1000) ? 1000 : refreshHz);
+	m_PeriodMs = 1000 / refreshHz;
+}
+void Viewfinder::Post(const cv::Mat &RGB, const cv::Mat &IR)
+{
+	// cheap test first, most frames are not wanted
+	if (!m_Wanted)
+		return;
+	if (pthread_mutex_trylock(&m_Lock) != 0)
+		return;	// display is busy with the queue, skip this frame
+	if (m_Wanted)
+	{
+		RGB.copyTo(m_RGB);	// the capture buffers are reused for the next frame
+		IR.copyTo(m_IR);
+		m_Ready = true;
+		m_Wanted = false;
+	}
+	pthread_mutex_unlock(&m_Lock);
+}
+int Viewfinder::Key()
+{
+	int key = -1;
+	pthread_mutex_lock(&m_Lock);
+	if (!m_Keys.empty())
+	{
+		key = m_Keys.front();
+		m_Keys.pop_front();
+	}
+	pthread_mutex_unlock(&m_Lock);
+	return key;
+}
+
+// ************************************************************************
+// ***************  Private Methods for Viewfinder  ***********************
+// ************************************************************************
+static long NowMs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+void *Viewfinder::Thread(void *arg)
+{
+	Viewfinder *pView = (Viewfinder *)arg;
+	// the windows belong to this thread, HighGUI is not safe to share
+	cv::Mat RGB, IR;
+	long due = NowMs();
+	int wait, key;
+	while (!pView->m_Quit)
+	{
+		pthread_mutex_lock(&pView->m_Lock);
+		if (!pView->m_Ready && (NowMs() >= due))
+			pView->m_Wanted = true;
+		bool ready = pView->m_Ready;
+		if (ready)
+		{
+			// take the frame, Post() copies into the buffers given back here
+			cv::Mat t = RGB; RGB = pView->m_RGB; pView->m_RGB = t;
+			t = IR; IR = pView->m_IR; pView->m_IR = t;
+			pView->m_Ready = false;
+		}
+		pthread_mutex_unlock(&pView->m_Lock);
+		if (ready)
+		{
+			pView->Show(RGB, IR);
+			due = NowMs() + pView->m_PeriodMs;
+		}
+		// waitKey also runs the GUI event loop, keep it short while a frame is wanted
+		wait = (int)(due - NowMs());
+		wait = (wait < 1) ? 1 : wait;
+		key = cv::waitKey(wait);
+		if (key != -1)
+		{
+			pthread_mutex_lock(&pView->m_Lock);
+			pView->m_Keys.push_back(key);
+			pthread_mutex_unlock(&pView->m_Lock);
+		}
+	}
+	pView->m_Wanted = false;
+	cv::destroyAllWindows();
+	return NULL;
+}
+void Viewfinder::Show(cv::Mat &RGB, cv::Mat &IR)
+{
+	std::vector<cv::Mat> plane;
+	cv::split(RGB,plane);
+	cv::imshow("frameB",plane[0]);
+	cv::imshow("frameG",plane[1]);
+	cv::imshow("frameR",plane[2]);
+	cv::imshow("frameRGB",RGB);	// viewfinder displays
+	cv::imshow("frameIR",IR);
+	m_Shown++;
+}
+#endif // HEADLESS
@@ -0,0 +1,86 @@
+#ifndef BAYERCAL_HEADER
+#define BAYERCAL_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// BayerCal holds the black level, dark frame and flat field calibration
+// of one camera.  Sites are indexed the same as the raw Y16 buffer
+// (x + width * y) and follow the See3CAM_CU40 pattern   B G
+//                                                      IR R
+// The calibration is folded into two per site tables when it changes:
+//		m_Offset[i] = dark frame value (or the channel black level)
+//		m_Gain[i]   = flat field gain in Q12 fixed point
+// so the extraction loop only needs Correct() = ((raw - offset) * gain) >> 12
+#define BAYERCAL_GAIN_SHIFT 12
+#define BAYERCAL_GAIN_ONE (1 << BAYERCAL_GAIN_SHIFT)
+#define BAYERCAL_GAIN_MAX 32767		// just under 8x, keeps raw * gain in an int
+
+class BayerCal
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+	typedef enum channels
+	{
+		CH_B = 0,
+		CH_G,
+		CH_IR,
+		CH_R,
+		CH_COUNT
+	} CHANNEL;
+
+	BayerCal();
+	~BayerCal();
+	ERR SetSize(int width, int height);	// clears any dark or flat frame
+	bool Matches(int width, int height){return (width == m_Width && height == m_Height);};
+	bool Enabled(){return m_Enabled;};
+	void Enable(bool enable){m_Enabled = enable;};
+	static int Channel(int x, int y){return ((y & 1) << 1) | (x & 1);};
+	void SetBlackLevel(int channel, int level);
+	int GetBlackLevel(int channel);
+	// Dark frame is the average of frames taken with the lens capped.
+	// It also sets the per channel black levels to the channel means.
+	void BeginDark();
+	ERR AddDark(uint8_t *src, int srcLen);
+	ERR EndDark();
+	void ClearDark();
+	bool HasDark(){return !m_Dark.empty();};
+	// Flat field is the average of frames of a uniformly lit target,
+	// it is turned into a gain that flattens each channel to its mean
+	void BeginFlat();
+	ERR AddFlat(uint8_t *src, int srcLen);
+	ERR EndFlat();
+	void ClearFlat();
+	bool HasFlat(){return !m_Flat.empty();};
+	ERR Save(std::string fileName);
+	ERR Load(std::string fileName);
+	// corrected value of raw sample at site index i, not clipped at the top
+	inline int Correct(int raw, int i)
+	{
+		int v = ((raw - (int)m_Offset[i]) * (int)m_Gain[i]) >> BAYERCAL_GAIN_SHIFT;
+		return (v < 0) ? 0 : v;
+	};
+
+protected:
+	ERR Accumulate(uint8_t *src, int srcLen);
+	void Prepare();	// rebuild m_Offset and m_Gain
+
+private:
+	int m_Width, m_Height;
+	bool m_Enabled;
+	int m_Black[CH_COUNT];
+	std::vector<unsigned short> m_Dark;	// averaged dark frame
+	std::vector<unsigned short> m_Flat;	// averaged flat field frame
+	std::vector<uint32_t> m_Accum;	// running sum while capturing
+	int m_AccumCount;
+	// precomputed tables used by Correct()
+	std::vector<unsigned short> m_Offset;
+	std::vector<unsigned short> m_Gain;
+};
+
+#endif // BAYERCAL_HEADER
@@ -0,0 +1,70 @@
+#ifndef BAYEREXTRACT_HEADER
+#define BAYEREXTRACT_HEADER
+#include <stdint.h>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "bayercal.h"
+#include "defectmap.h"
+#include "framestats.h"
+#include "framepyramid.h"
+#include "transfertable.h"
+
+// Extraction of the See3CAM_CU40 Y16 raw Bayer buffers
+//		B G
+//		IR R
+// into an RGB plane and an IR plane (CV_8UC3/CV_8UC1 or CV_16UC3/CV_16UC1).
+// Buffers may arrive in bands; start is where the previous band ended
+// and the return value is where this one ends, a frame is complete once
+// its y reaches the plane height.  Calibration, defect correction,
+// statistics and the reduced levels of a pyramid are fused into the pass
+// when they are given.
+extern float IRGain[3];	// IR subtracted from B, G, R
+
+cv::Point2i ExtractBayerY16toRGB(cv::Mat &dstRGB, cv::Mat &dstIR, uint8_t * src, int srcLen, cv::Point2i start,
+								 BayerCal *pCal = NULL, DefectMap *pDefects = NULL, FrameStats *pStats = NULL,
+								 FramePyramid *pPyramid = NULL);
+
+// The same extraction straight to 8 bit YUV 4:2:0 for video encoders, in one pass:
+// each 2x2 cell is one chroma sample, gamma encoded with pCurve (8 bit output, its
+// input range is white; sRGB of 1024 codes if NULL, pass the camera's InputRange()
+// to match the other outputs) and converted with BT.601 video range.  dstYUV
+// is CV_8UC1 of (height * 3 / 2) x width laid out as I420 (Y, U, V planes) or
+// NV12 (Y, then U V interleaved); dstIR, unless empty, gets IR through the curve.
+typedef enum
+{
+	YUV_I420 = 0,
+	YUV_NV12
+} YUV_LAYOUT;
+cv::Point2i ExtractBayerY16toYUV420(cv::Mat &dstYUV, cv::Mat &dstIR, YUV_LAYOUT layout, uint8_t * src, int srcLen, cv::Point2i start,
+									const TransferTable *pCurve = NULL, BayerCal *pCal = NULL, DefectMap *pDefects = NULL,
+									FrameStats *pStats = NULL);
+
+// The same extraction of only some regions of a whole frame, for analytics that
+// need a rectangle or two: each rois[i] is extracted straight from the buffer into
+// dstRGB[i] and dstIR[i] of its own size and the given depth (CV_8U or CV_16U),
+// so the cost follows the area.  Regions must lie on the 2x2 cells (even x, y,
+// width and height) inside the frame; the others are left empty.  The defects of
+// the rows of each region are patched in the buffer.  Returns the regions done.
+// CameraV4L2::ConvertTosRGB(planes) converts the results in place.
+int ExtractBayerY16toRGBROI(std::vector<cv::Mat> &dstRGB, std::vector<cv::Mat> &dstIR, const std::vector<cv::Rect> &rois,
+							int depth, uint8_t * src, int srcLen, int width, int height,
+							BayerCal *pCal = NULL, DefectMap *pDefects = NULL);
+
+// Binned extraction for low light: the samples of each channel in bin x bin cells
+// (bin 2 or 4) are combined, which is where the IR sites gain the most.  BIN_SUM
+// keeps the sum (bin * bin times the range of ExtractBayerY16toRGB() 16 bit planes),
+// BIN_AVERAGE the mean at the usual range with the noise down by bin.  dstRGB and
+// dstIR are CV_16UC3/CV_16UC1; at the frame size each bin is repeated over the
+// 2 * bin square of pixels it covers, as a cell is by ExtractBayerY16toRGB(), so the
+// stages after it are unchanged, otherwise they are made (height / (2 * bin)) x
+// (width / (2 * bin)).  Needs the whole frame; pStats gets one sample per bin.
+typedef enum
+{
+	BIN_SUM = 0,
+	BIN_AVERAGE
+} BIN_MODE;
+bool ExtractBayerY16toRGBBinned(cv::Mat &dstRGB, cv::Mat &dstIR, int bin, BIN_MODE mode, uint8_t * src, int srcLen,
+								int width, int height, BayerCal *pCal = NULL, DefectMap *pDefects = NULL,
+								FrameStats *pStats = NULL);
+
+#endif // BAYEREXTRACT_HEADER
@@ -0,0 +1,71 @@
+#ifndef BUSFORMAT_HEADER
+#define BUSFORMAT_HEADER
+#include <stdint.h>
+
+// Shared memory frame bus written by FrameBus and read by BusReader.
+// The POSIX shared memory object /<name> holds:
+//
+//	0							BUS_HEADER, padded to BUS_HEADER_BYTES
+//	headerBytes + i * slotBytes	slot i: BUS_SLOT, then the planes at
+//								planeOffset[] from the slot, each BUS_ALIGN aligned
+//
+// Frame n goes in slot n % slots.  Each slot is a seqlock: lock is odd
+// while the publisher writes the slot and is bumped again when it is done,
+// so a reader that sees the same even value before and after using the
+// planes knows they were not overwritten underneath it.  published counts
+// the frames written and is also the futex readers sleep on.  Frame
+// numbers are 32 bit and compared as differences, so they may wrap.
+#define BUS_MAGIC "CV4B"
+#define BUS_VERSION 3
+#define BUS_HEADER_BYTES 4096	// the header has a page of its own
+#define BUS_ALIGN 64			// cache line, slots and planes start on one
+
+typedef enum
+{
+	BUS_RAW = 0,	// Y16 with known defects patched, not calibrated, CV_16UC1
+	BUS_RGB,		// extracted RGB, CV_8UC3 or CV_16UC3
+	BUS_IR,			// extracted IR, CV_8UC1 or CV_16UC1
+	BUS_RGB_HALF,	// FramePyramid level 1, (width >> 1) x (height >> 1), as BUS_RGB
+	BUS_IR_HALF,	// level 1, as BUS_IR
+	BUS_RGB_QUARTER,	// level 2, (width >> 2) x (height >> 2)
+	BUS_IR_QUARTER,
+	BUS_PLANES
+} BUS_PLANE;
+#define BUS_PLANE_BIT(p) (1 << (p))
+#define BUS_ALL (BUS_PLANE_BIT(BUS_RAW) | BUS_PLANE_BIT(BUS_RGB) | BUS_PLANE_BIT(BUS_IR))
+#define BUS_PYRAMID (BUS_PLANE_BIT(BUS_RGB_HALF) | BUS_PLANE_BIT(BUS_IR_HALF) \
+					 | BUS_PLANE_BIT(BUS_RGB_QUARTER) | BUS_PLANE_BIT(BUS_IR_QUARTER))
+#define BUS_LEVELS 3	// pyramid levels carried, the frame included
+#define BUS_PLANE_LEVEL(p) (((p) < BUS_RGB_HALF) ? 0 : ((p) - BUS_RGB_HALF) / 2 + 1)
+
+typedef struct
+{
+	char magic[4];				// BUS_MAGIC
+	uint32_t version;			// BUS_VERSION
+	uint32_t headerBytes;		// BUS_HEADER_BYTES, slot 0 starts here
+	uint32_t slots;
+	uint32_t slotBytes;			// from one slot to the next
+	uint32_t width;
+	uint32_t height;			// of the frame, pyramid planes are smaller (BUS_PLANE_LEVEL)
+	uint32_t planes;			// BUS_PLANE_BIT of the planes carried
+	uint32_t planeType[BUS_PLANES];		// OpenCV type, 0 if not carried
+	uint32_t planeOffset[BUS_PLANES];	// from the start of the slot
+	uint32_t planeBytes[BUS_PLANES];	// room for the plane
+	int32_t pid;				// of the publisher
+	volatile uint32_t closed;	// set when the publisher stops
+	volatile uint32_t published;	// frames written, futex word
+} BUS_HEADER;
+
+typedef struct
+{
+	volatile uint32_t lock;		// seqlock, odd while being written
+	uint32_t frame;				// bus frame number, n for the n-th published
+	uint32_t sequence;			// from the driver
+	int32_t exposure;			// 1/10 ms, -1 if unknown
+	int64_t seconds;			// driver timestamp
+	int64_t microseconds;
+	uint32_t bytes[BUS_PLANES];	// of each plane in this frame, 0 if missing
+	float sharpness[2];			// FocusMeter G and IR, -1 if not measured
+} BUS_SLOT;
+
+#endif // BUSFORMAT_HEADER
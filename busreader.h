@@ -0,0 +1,71 @@
+#ifndef BUSREADER_HEADER
+#define BUSREADER_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <string>
+#include <opencv2/core/core.hpp>
+#include "busformat.h"
+
+// BusReader attaches to a FrameBus published by another process (see
+// busformat.h) and hands out its frames in place, without copying.
+// Any number of readers may attach; each maps the bus read only and
+// keeps its own place in it, starting with the next frame published.
+// A frame handed out by Next() stays in its slot until the publisher
+// comes round to it again, BUS_SLOTS frames later: check Valid() after
+// using the planes (or Copy() them out) to know they were not being
+// overwritten.  Frames skipped because the reader fell too far behind
+// are counted in Overruns().
+class BusReader
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL,
+		OVERRUN		// the frame was overwritten while it was being used
+	} ERR;
+	typedef struct
+	{
+		uint32_t frame;			// bus frame number
+		uint32_t sequence;		// from the driver
+		int exposure;
+		struct timeval timestamp;
+		const uint8_t *pPlane[BUS_PLANES];	// in the bus, NULL if not in this frame
+		int bytes[BUS_PLANES];
+		float sharpness[2];		// G and IR, -1 if not measured
+		uint32_t lock;			// slot seqlock when the frame was taken
+		const BUS_SLOT *pSlot;
+	} BUS_FRAME;
+
+	BusReader();
+	~BusReader();
+	ERR Open(std::string name);
+	void Close();
+	bool IsOpen(){return m_pHeader != NULL;};
+	bool Alive();	// the publisher is still running
+	int Width(){return m_pHeader ? (int)m_pHeader->width : 0;};
+	int Height(){return m_pHeader ? (int)m_pHeader->height : 0;};
+	int Planes(){return m_pHeader ? (int)m_pHeader->planes : 0;};	// BUS_PLANE_BIT mask
+	uint32_t Published(){return m_pHeader ? m_pHeader->published : 0;};
+	// waits up to timeoutMs (< 0 for ever) for the frame after the last one,
+	// jumping to the newest when it fell behind, FAIL on timeout or when the bus closes
+	ERR Next(BUS_FRAME &frame, int timeoutMs = -1);
+	bool Valid(const BUS_FRAME &frame);	// still what Next() returned
+	cv::Mat Plane(const BUS_FRAME &frame, int plane);	// header over the bus, empty if missing
+	ERR Copy(const BUS_FRAME &frame, int plane, cv::Mat &dst);	// OVERRUN if overwritten meanwhile
+	unsigned int Overruns(){return m_Overruns;};
+
+private:
+	ERR Wait(uint32_t frame, int timeoutMs);
+	ERR Take(uint32_t frame, BUS_FRAME &out);
+
+	std::string m_Name;
+	const uint8_t *m_pMap;
+	size_t m_Size;
+	const BUS_HEADER *m_pHeader;
+	uint32_t m_Next;		// next frame wanted
+	unsigned int m_Overruns;
+};
+
+#endif // BUSREADER_HEADER
@@ -9,8 +9,19 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <vector>
 #include <opencv2/core/core.hpp>
-#include <opencv2/highgui/highgui.hpp>
+#include "framestats.h"
+#include "transfertable.h"
+#include "threadpool.h"
+
+// Auto exposure defaults
+#define AE_TARGET 0.18F		// metered mean as a fraction of the input range
+#define AE_INTERVAL 4		// frames between exposure updates (control latency)
+#define AE_TOLERANCE 0.08F	// relative error inside which AE is converged
+#define AE_CLIP_LIMIT 0.02F	// fraction of clipped samples that forces the exposure down
+#define AE_TARGET_MIN 0.01F	// targets are held to [AE_TARGET_MIN..1 - AE_TOLERANCE] so AE can converge
+#define AE_TARGET_MAX (1.0F - AE_TOLERANCE)
 
 class CameraV4L2
 {
@@ -24,6 +35,7 @@ public:
 	CameraV4L2(std::string device, int inputRange = 1024);
 	~CameraV4L2();
 	bool Exists();
+	std::string BusInfo();	// identifies this camera, e.g. for its calibration file
 	ERR SetSize(int width, int height);	// FAIL if not supported
 	ERR PrintCaps();
 	ERR	SetFormat(struct v4l2_format &fmt);
@@ -33,11 +45,31 @@ public:
 	ERR Start();
 	ERR Stop();
 	uint8_t* Buffer(){return m_Buffer;};
+	uint32_t Sequence(){return m_buf.sequence;};	// of the current buffer, from the driver
+	struct timeval Timestamp(){return m_buf.timestamp;};	// of the current buffer
+	int Exposure(){return m_Exposure;};	// last set or read, 1/10 ms, -1 if unknown
 	int GetExposure();	// in 1/10 ms
 	ERR SetExposure(int tenth_ms);
 	int GetBrightness();	// [0..40]
 	ERR SetBrightness(int val);
-	ERR ConvertTosRGB(cv::Mat &src, cv::Mat &dst);
+	int InputRange(){return m_InputRange;};	// of 16 bit planes
+	ERR ConvertTosRGB(cv::Mat &src, cv::Mat &dst);	// dst may be src, strips run on ThreadPool::Shared()
+	ERR ConvertTosRGB(std::vector<cv::Mat> &planes);	// each in place, e.g. the planes of regions
+	// Auto exposure, driven by the statistics of each frame
+	typedef enum meter
+	{
+		AE_LUMA = 0,	// B, G, R weighted as luma
+		AE_IR
+	} AE_METER;
+	ERR SetAutoExposure(bool enable, float target = AE_TARGET, int interval = AE_INTERVAL, AE_METER meter = AE_LUMA);
+	bool AutoExposure(){return m_AEEnabled;};
+	float AETarget(){return m_AETarget;};
+	void SetAETarget(float target){m_AETarget = ClampAETarget(target); m_AEWait = 0;};
+	int AEInterval(){return m_AEInterval;};
+	AE_METER AEMeter(){return m_AEMeter;};
+	ERR UpdateAutoExposure(FrameStats &stats);	// call once per frame
+	ERR UpdateAutoExposure(uint8_t *src, int srcLen);	// without stats, samples a sparse grid
+	float AEConvergenceTime(){return m_AEConvergence;};	// seconds, of the last correction
 	
 protected:
 	// this device
@@ -53,12 +85,31 @@ protected:
 	int xioctl(int request, void *arg);
 	
 private:
+	static float ClampAETarget(float target)
+	{
+		return (target < AE_TARGET_MIN) ? AE_TARGET_MIN : ((target > AE_TARGET_MAX) ? AE_TARGET_MAX : target);
+	};
+
 	std::string m_DeviceName;
 	// mapped pointer to current buffer
 	struct v4l2_buffer m_buf;	// current buffer in play
 	uint8_t *m_Buffer;	// mapped location of m_buf
-	static unsigned char sRGBVal8[1024];
-	static unsigned short sRGBVal16[1024];
+	int m_Exposure;		// without asking the driver every frame
+	// auto exposure state
+	bool m_AEEnabled;
+	AE_METER m_AEMeter;
+	float m_AETarget;
+	int m_AEInterval;
+	int m_AEWait;		// frames until the last update shows in the stats
+	int m_AEExposure;	// current exposure, 1/10 ms
+	int m_AEMin, m_AEMax;
+	bool m_AEConverged;
+	double m_AEStart;	// time the current correction started
+	float m_AEConvergence;
+	int m_InputRange;
+	// sRGB encoding tables for 8 bit and 16 bit planes, shared with other instances
+	const TransferTable *m_pSRGB8;
+	const TransferTable *m_pSRGB16;
 };
 
 #endif // CAMERAV4L2_HEADER
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef CHANGEDETECTOR_HEADER
+#define CHANGEDETECTOR_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// ChangeDetector tells from the raw Y16 buffer, before anything else touches
+// it, whether a frame differs from the last frame that was processed.  It
+// samples one 2x2 cell (the sum of its four sites) every CHANGE_STEP pixels
+// and counts the samples that moved by more than the level; the frame has
+// changed when more than the area fraction of them did.  Unchanged frames
+// are compared with the same reference, so a slow drift is still caught
+// once it adds up.  A frame is always reported changed after keepAlive
+// unchanged ones so the outputs are refreshed now and then.
+#define CHANGE_STEP 16			// pixels between samples, even
+#define CHANGE_LEVEL 32			// codes of the 4 site sum, about 4 sigma of read noise
+#define CHANGE_AREA 0.005F		// fraction of the samples
+#define CHANGE_KEEPALIVE 50		// frames
+
+class ChangeDetector
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	ChangeDetector();
+	ERR Setup(int width, int height, int step = CHANGE_STEP);
+	void SetThreshold(int level, float area = CHANGE_AREA){m_Level = level; m_Area = area;};
+	void SetKeepAlive(int frames){m_KeepAlive = frames;};	// 0 for never
+	bool Ready(){return !m_Reference.empty();};
+	void Reset();	// the next frame is changed
+	bool Test(const uint8_t *raw, int rawLen);	// and takes it as the reference if it changed
+	float Changed(){return m_Changed;};		// fraction of the samples that moved in the last frame
+	unsigned int Tested(){return m_Tested;};
+	unsigned int Skipped(){return m_Skipped;};
+
+private:
+	int m_Width, m_Height, m_Step;
+	int m_Cols, m_Rows;		// samples
+	int m_Level;
+	float m_Area;
+	int m_KeepAlive;
+	int m_Unchanged;		// since the reference was taken
+	bool m_Valid;			// there is a reference
+	float m_Changed;
+	unsigned int m_Tested, m_Skipped;
+	std::vector<unsigned short> m_Reference;
+	std::vector<unsigned short> m_Current;
+};
+
+#endif // CHANGEDETECTOR_HEADER
@@ -0,0 +1,85 @@
+#ifndef COLORENGINE_HEADER
+#define COLORENGINE_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "transfertable.h"
+
+// ColorEngine grades the linear RGB output of the extraction in one pass:
+//		linear BGR --1D curve--> 16 bit encoded BGR --3D LUT--> graded BGR
+// The 1D curve is any TransferTable with 16 bit output whose input range
+// matches the plane (sRGB, Rec.709, log or a user curve).  The 3D LUT is an
+// N^3 lattice (e.g. 33^3, loaded from a .cube file) sampled with
+// tetrahedral interpolation in fixed point.  Without a 3D LUT only the
+// curve is applied.  Rows are split into strips on ThreadPool::Shared().
+#define COLOR_LUT_MAX 65	// largest lattice size
+#define COLOR_FRAC_BITS 12	// interpolation weights
+
+class ColorEngine
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	ColorEngine();
+	~ColorEngine();
+	bool Enabled(){return m_Enabled && (m_pCurve != NULL);};
+	void Enable(bool enable){m_Enabled = enable;};
+	ERR SetCurve(const TransferTable *pCurve);	// not owned, must have 16 bit output
+	// lattice of n^3 entries in .cube order (red fastest), values in [0..1]
+	ERR SetLUT(int n, const std::vector<float> &rgb);
+	ERR LoadCube(std::string fileName);
+	void ClearLUT(){m_Size = 0; m_Lattice.clear();};
+	int LUTSize(){return m_Size;};
+	ERR Apply(cv::Mat &src, cv::Mat &dst);	// CV_8UC3 or CV_16UC3, dst may be src
+	// one strip, pRow is room for one row of src in 16 bit
+	void ApplyRows(cv::Mat &src, cv::Mat &dst, int first, int end, unsigned short *pRow);
+
+	// tetrahedral lookup of one 16 bit encoded pixel, in place (B, G, R order)
+	inline void Lookup(int *bgr)
+	{
+		int n1 = m_Size - 1;
+		int pr = bgr[2] * n1, pg = bgr[1] * n1, pb = bgr[0] * n1;
+		int ir = pr >> 16, ig = pg >> 16, ib = pb >> 16;
+		int fr = (pr >> (16 - COLOR_FRAC_BITS)) & ((1 << COLOR_FRAC_BITS) - 1);
+		int fg = (pg >> (16 - COLOR_FRAC_BITS)) & ((1 << COLOR_FRAC_BITS) - 1);
+		int fb = (pb >> (16 - COLOR_FRAC_BITS)) & ((1 << COLOR_FRAC_BITS) - 1);
+		// lattice is stored blue fastest, 3 shorts (B, G, R) per node
+		const unsigned short *c000 = &m_Lattice[3 * ((ir * m_Size + ig) * m_Size + ib)];
+		int sr = 3 * m_Size * m_Size, sg = 3 * m_Size, sb = 3;
+		const unsigned short *c111 = c000 + sr + sg + sb;
+		const unsigned short *p1, *p2;	// the two inner corners of the tetrahedron
+		int w1, w2, w3;	// weights along c000->p1, p1->p2, p2->c111
+		if (fr > fg)
+		{
+			if (fg > fb)		{ p1 = c000 + sr; p2 = p1 + sg; w1 = fr; w2 = fg; w3 = fb; }
+			else if (fr > fb)	{ p1 = c000 + sr; p2 = p1 + sb; w1 = fr; w2 = fb; w3 = fg; }
+			else				{ p1 = c000 + sb; p2 = p1 + sr; w1 = fb; w2 = fr; w3 = fg; }
+		}
+		else
+		{
+			if (fb > fg)		{ p1 = c000 + sb; p2 = p1 + sg; w1 = fb; w2 = fg; w3 = fr; }
+			else if (fb > fr)	{ p1 = c000 + sg; p2 = p1 + sb; w1 = fg; w2 = fb; w3 = fr; }
+			else				{ p1 = c000 + sg; p2 = p1 + sr; w1 = fg; w2 = fr; w3 = fb; }
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			bgr[k] = c000[k] + ((w1 * (p1[k] - c000[k]) + w2 * (p2[k] - p1[k])
+				+ w3 * (c111[k] - p2[k]) + (1 << (COLOR_FRAC_BITS - 1))) >> COLOR_FRAC_BITS);
+		}
+	};
+
+private:
+	bool m_Enabled;
+	const TransferTable *m_pCurve;
+	int m_Size;	// lattice points per axis, 0 for no 3D LUT
+	std::vector<unsigned short> m_Lattice;
+	std::vector<unsigned short> m_Rows;	// a row per strip for Apply(), only grows
+};
+
+#endif // COLORENGINE_HEADER
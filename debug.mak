@@ -15,7 +15,7 @@ OBJCOPY := objcopy
 PREPROCESSOR_MACROS := DEBUG=1
 INCLUDE_DIRS := 
 LIBRARY_DIRS := 
-LIBRARY_NAMES := opencv_highgui opencv_core opencv_imgproc
+LIBRARY_NAMES := opencv_highgui opencv_core opencv_imgproc pthread rt
 ADDITIONAL_LINKER_INPUTS := 
 MACOS_FRAMEWORKS := 
 LINUX_PACKAGES := 
@@ -0,0 +1,50 @@
+#ifndef DEFECTMAP_HEADER
+#define DEFECTMAP_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// DefectMap is a sparse list of the defective (hot or stuck) sites of one
+// camera, kept sorted by site index (x + width * y) of the raw Y16 buffer.
+// Correct() replaces each listed site with the median of its same channel
+// neighbours (2 sites away in the 2x2 pattern) so its cost follows the
+// number of defects and not the size of the frame.
+// The map is either loaded from a text file of "x y" lines or learned from
+// dark frames: sites that sit well above their channel mean are listed.
+#define DEFECTMAP_THRESHOLD 64	// default learn threshold above the channel mean
+
+class DefectMap
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	DefectMap();
+	~DefectMap();
+	ERR SetSize(int width, int height);	// clears the map
+	bool Matches(int width, int height){return (width == m_Width && height == m_Height);};
+	int Count(){return (int)m_Sites.size();};
+	ERR Add(int x, int y);
+	void Clear(){m_Sites.clear();};
+	bool IsDefect(int x, int y);
+	// learning from dark frames (lens capped)
+	void BeginLearn();
+	ERR AddLearn(uint8_t *src, int srcLen);
+	ERR EndLearn(int threshold = DEFECTMAP_THRESHOLD);
+	ERR Save(std::string fileName);
+	ERR Load(std::string fileName);
+	// correct rows [yStart..yEnd) of a raw Y16 frame in place
+	void Correct(unsigned short *pSrc, int yStart, int yEnd);
+
+private:
+	int m_Width, m_Height;
+	std::vector<uint32_t> m_Sites;	// sorted site indices
+	std::vector<uint32_t> m_Accum;	// running sum while learning
+	int m_AccumCount;
+};
+
+#endif // DEFECTMAP_HEADER
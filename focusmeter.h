@@ -0,0 +1,60 @@
+#ifndef FOCUSMETER_HEADER
+#define FOCUSMETER_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+// FocusMeter measures the sharpness of the green and IR planes of each frame
+// as the variance of their Laplacian over a region of interest.  The planes
+// repeat each 2x2 cell of the mosaic, so the measure is taken on the cell
+// grid, where the sensor actually has detail.  Rows of cells are gathered
+// into short rows and the 5 point Laplacian is summed in chunks the compiler
+// vectorizes (16 bit products into 32 bit sums).  Values are in 8 bit code
+// values squared for both plane depths; they rise as the lens comes into
+// focus and depend on the scene, so they are compared over time: Average()
+// is smoothed over FOCUS_AVERAGE frames, Peak() the best average since
+// Reset(), and Drift() how far the average has fallen from the peak.
+#define FOCUS_AVERAGE 16	// frames
+#define FOCUS_DRIFT 0.3F	// fall from the peak that counts as drifted
+#define FOCUS_CHUNK 128		// cells summed in 32 bits
+
+class FocusMeter
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+	typedef enum channels
+	{
+		FOCUS_G = 0,
+		FOCUS_IR,
+		FOCUS_CHANNELS
+	} CHANNEL;
+
+	FocusMeter();
+	void SetROI(cv::Rect roi){m_ROI = roi;};	// frame pixels, empty for the centre half
+	cv::Rect ROI(){return m_ROI;};
+	void Reset();	// forgets the average and peak
+	ERR Measure(const cv::Mat &RGB, const cv::Mat &IR);	// extraction output, 8 or 16 bit
+	float Sharpness(int channel){return m_Sharpness[channel];};	// of the last frame, -1 before the first
+	float Average(int channel){return m_Average[channel];};
+	float Peak(int channel){return m_Peak[channel];};
+	float Drift(int channel){return (m_Peak[channel] > 0.0F) ? 1.0F - m_Average[channel] / m_Peak[channel] : 0.0F;};
+	bool Drifted(){return (Drift(FOCUS_G) > FOCUS_DRIFT) || (Drift(FOCUS_IR) > FOCUS_DRIFT);};
+	unsigned int Frames(){return m_Frames;};
+
+private:
+	float Variance(const cv::Mat &src, int channel, cv::Rect cells);
+
+	cv::Rect m_ROI;
+	float m_Sharpness[FOCUS_CHANNELS];
+	float m_Average[FOCUS_CHANNELS];
+	float m_Peak[FOCUS_CHANNELS];
+	unsigned int m_Frames;
+	std::vector<short> m_Rows;	// three rows of cells
+};
+
+#endif // FOCUSMETER_HEADER
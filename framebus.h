@@ -0,0 +1,52 @@
+#ifndef FRAMEBUS_HEADER
+#define FRAMEBUS_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <string>
+#include <opencv2/core/core.hpp>
+#include "busformat.h"
+#include "framepyramid.h"
+
+// FrameBus publishes every frame into a POSIX shared memory ring (see
+// busformat.h) so other processes on the machine (analytics, recorders,
+// HMI) can use the frames without the camera, with BusReader.  Publish()
+// copies the planes into the next slot under its seqlock and wakes the
+// readers; it never waits for them, a reader that falls more than a lap
+// behind sees an overrun instead.  Readers only map the bus read only.
+// With BUS_PYRAMID the half and quarter levels of a FramePyramid travel
+// with the frame for readers that work on reduced frames.
+#define BUS_SLOTS 8		// frames kept for the readers
+
+class FrameBus
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	FrameBus();
+	~FrameBus();
+	// planes is a mask of BUS_PLANE_BIT, depth (CV_8U or CV_16U) is that of the RGB and IR planes and their levels
+	ERR Create(std::string name, int width, int height, int planes = BUS_ALL, int depth = CV_16U, int slots = BUS_SLOTS);
+	void Close();	// tells the readers and removes the name
+	bool IsOpen(){return m_pHeader != NULL;};
+	// raw is the camera buffer after the extraction patched its defects, planes not carried or empty are left out of the frame
+	// sharpness is the G and IR focus measure, if there is one, pPyramid the levels built with the frame
+	ERR Publish(const uint8_t *raw, int rawLen, const cv::Mat &RGB, const cv::Mat &IR,
+				uint32_t sequence, struct timeval timestamp, int exposure, const float *sharpness = NULL,
+				FramePyramid *pPyramid = NULL);
+	uint32_t Published(){return m_pHeader ? m_pHeader->published : 0;};
+
+private:
+	void PutPlane(BUS_SLOT *pSlot, int plane, const cv::Mat &src);
+
+	std::string m_Name;
+	uint8_t *m_pMap;
+	size_t m_Size;
+	BUS_HEADER *m_pHeader;
+};
+
+#endif // FRAMEBUS_HEADER
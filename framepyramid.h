@@ -0,0 +1,55 @@
+#ifndef FRAMEPYRAMID_HEADER
+#define FRAMEPYRAMID_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <opencv2/core/core.hpp>
+
+// FramePyramid is the RGB and IR planes of a frame at full, half, quarter ...
+// resolution, filled by the extraction as it goes.  Each 2x2 cell of the
+// mosaic is one pixel of level 1, which is written with the frame, and each
+// completed pair of rows of a level is box filtered into the next level while
+// it is still in cache.  Level 0 is the frame itself.  Levels 1 and up live in
+// one contiguous block, each row aligned to PYRAMID_ALIGN bytes, which is only
+// reallocated when the frame size, depth or number of levels changes.
+#define PYRAMID_LEVELS 3		// full, half and quarter resolution
+#define PYRAMID_LEVELS_MAX 8
+#define PYRAMID_ALIGN 64		// cache line
+
+class FramePyramid
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	FramePyramid(int levels = PYRAMID_LEVELS);
+	~FramePyramid();
+	ERR SetLevels(int levels);	// including level 0, takes effect at the next frame
+	int Levels(){return m_Built;};	// of the current frame, 0 before the first
+	cv::Mat &LevelRGB(int level){return m_RGB[level];};	// level < Levels()
+	cv::Mat &LevelIR(int level){return m_IR[level];};
+	size_t Bytes(){return m_Bytes;};	// of the block
+
+	// used by the extraction: Begin() at the first band of a frame lays out the
+	// levels for its planes, EndRow() after each row of level 1 is written
+	ERR Begin(cv::Mat &RGB, cv::Mat &IR);
+	void EndRow(int row);
+
+private:
+	int LevelsFor(int width, int height);
+	ERR Layout(int width, int height, int depth);
+	void Reduce(int level, int row);	// one row of level from the two above it
+	void Free();
+
+	int m_Levels;		// requested
+	int m_Width, m_Height, m_Depth;	// of the frame the block is laid out for
+	int m_Built;		// levels laid out, m_Levels unless the frame is too small
+	unsigned char *m_pBlock;
+	size_t m_Bytes;
+	cv::Mat m_RGB[PYRAMID_LEVELS_MAX];
+	cv::Mat m_IR[PYRAMID_LEVELS_MAX];
+};
+
+#endif // FRAMEPYRAMID_HEADER
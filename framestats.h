@@ -0,0 +1,71 @@
+#ifndef FRAMESTATS_HEADER
+#define FRAMESTATS_HEADER
+#include <stdint.h>
+#include <string.h>
+
+// FrameStats are the per channel measurements of one frame taken while the
+// extraction already has each sample in hand: a histogram, the sum and the
+// number of clipped (saturated) samples.  Channels are numbered in the
+// order of the 2x2 pattern   B G
+//                           IR R
+// Samples are the sensor values after calibration, before the IR is
+// subtracted, so clipping is seen where it happens.  Partial stats (one per
+// band or thread) are combined with Merge().
+#define FRAMESTATS_BINS 64
+
+class FrameStats
+{
+public:
+	typedef enum channels
+	{
+		FS_B = 0,
+		FS_G,
+		FS_IR,
+		FS_R,
+		FS_COUNT
+	} CHANNEL;
+
+	FrameStats(int inputRange = 1024);
+	void Reset();	// keeps the input range
+	void SetRange(int inputRange);
+	int Range(){return m_Range;};
+	void Merge(const FrameStats &other);
+	// raw is the sample before calibration, clipping is judged on it since
+	// a black level or dark frame moves saturated sites below m_Clip
+	inline void Add(int channel, int v, int raw)
+	{
+		int bin = v >> m_Shift;
+		hist[channel][(bin < FRAMESTATS_BINS) ? bin : FRAMESTATS_BINS - 1]++;
+		sum[channel] += v;
+		clipped[channel] += (raw >= m_Clip);
+		count[channel]++;
+	};
+	inline void Add(int channel, int v){Add(channel, v, v);};
+	inline void AddCell(int b, int g, int ir, int r)
+	{
+		Add(FS_B, b); Add(FS_G, g); Add(FS_IR, ir); Add(FS_R, r);
+	};
+	inline void AddCell(int b, int g, int ir, int r, int rawB, int rawG, int rawIR, int rawR)
+	{
+		Add(FS_B, b, rawB); Add(FS_G, g, rawG); Add(FS_IR, ir, rawIR); Add(FS_R, r, rawR);
+	};
+	float Mean(int channel);	// in input units
+	float ClippedFraction(int channel);
+	int Percentile(int channel, float fraction);	// upper edge of the bin, input units
+	float Luma();	// mean of B, G and R weighted as Rec.601 luma
+	// gather from every step'th 2x2 cell of a raw Y16 frame, for when the
+	// extraction did not (step is rounded up to even)
+	void SampleY16(uint8_t *src, int srcLen, int width, int height, int step = 16);
+
+	uint32_t hist[FS_COUNT][FRAMESTATS_BINS];
+	uint64_t sum[FS_COUNT];
+	uint32_t clipped[FS_COUNT];
+	uint32_t count[FS_COUNT];
+
+private:
+	int m_Range;	// input range, power of 2 >= FRAMESTATS_BINS
+	int m_Shift;	// input value to bin
+	int m_Clip;		// values at or above this are clipped
+};
+
+#endif // FRAMESTATS_HEADER
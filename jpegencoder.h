@@ -0,0 +1,74 @@
+#ifndef JPEGENCODER_HEADER
+#define JPEGENCODER_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "threadpool.h"
+
+// JpegEncoder writes baseline JPEG (JFIF, 4:2:0 colour or greyscale) by
+// coding horizontal strips of the image in parallel.  Each strip is a
+// whole number of MCU rows and one restart interval, so the strips are
+// coded independently and simply joined with RSTn markers into one valid
+// file.  The strips are coded on a thread pool, ThreadPool::Shared() unless
+// one is given.  Begin() sets up a frame; AddRows() tells the encoder how
+// many rows of it are final and codes the strips they complete, so a caller
+// producing the frame in bands (like the extraction) has each band coded as
+// it arrives.  Finish() codes what is left and joins the strips.  Encode()
+// does all three.
+// 16 bit planes are coded from their top 8 bits (SetShift to change).
+// One frame at a time per encoder.
+#define JPEG_QUALITY 80
+#define JPEG_STRIP_ROWS 16		// rows per restart interval, a multiple of 16
+
+class JpegEncoder
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	JpegEncoder(int quality = JPEG_QUALITY, ThreadPool *pPool = NULL);
+	~JpegEncoder();
+	void SetQuality(int quality);	// between frames
+	void SetShift(int shift){m_Shift = shift;};	// of 16 bit samples to 8 bit
+	int Threads(){return m_pPool->Threads();};
+	// src is CV_8UC1, CV_8UC3, CV_16UC1 or CV_16UC3 (BGR), it must stay until Finish()
+	ERR Begin(const cv::Mat &src, int stripRows = JPEG_STRIP_ROWS);
+	void AddRows(int rows);		// rows [0..rows) of src are final
+	ERR Finish(std::vector<unsigned char> &dst);
+	ERR Encode(const cv::Mat &src, std::vector<unsigned char> &dst);
+	// one strip, for the thread pool
+	void EncodeStrip(int strip);
+
+private:
+	typedef struct
+	{
+		unsigned short code[256];
+		unsigned char size[256];
+	} HUFFMAN;
+	typedef struct
+	{
+		std::vector<unsigned char> bytes;	// entropy coded, stuffed and padded
+	} STRIP;
+	void Code(int ready);	// the strips up to ready not coded yet
+	void Header(std::vector<unsigned char> &dst);
+
+	ThreadPool *m_pPool;	// not owned
+	int m_Quality;
+	int m_Shift;
+	unsigned char m_Quant[2][64];	// zigzag order, as written
+	float m_Scale[2][64];			// natural order, AAN scaling folded in
+	HUFFMAN m_DC[2], m_AC[2];
+	// the frame being coded
+	cv::Mat m_Src;
+	int m_Components;
+	int m_McuSize;				// 16 for colour, 8 for grey
+	int m_StripRows;
+	std::vector<STRIP> m_Strips;
+	int m_Next;					// next strip to code
+};
+
+#endif // JPEGENCODER_HEADER
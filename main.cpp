@@ -10,112 +10,33 @@
 // the camera and get buffers of the raw data.  This ExtractBayer10_Y16() 
 // routine takes the raw data and creates RGB and IR OpenCV Mat
 // objects from the data.  The capture routine gets the buffers from the Y16
-// stream on the camera and places the images into OpenCV named windows
-//  (as a "viewFinder").  When [anykey] is pressed capture returns to main()
+// stream on the camera and hands the images to a Viewfinder which shows them
+// in OpenCV named windows on its own thread.  When [anykey] is pressed capture returns to main()
 // where the images are written to files as ./RGB.jpg and ./IR.jpg
+// With -headless, or when built with HEADLESS=1 (no highgui at all), there are no
+// windows and frames run through the stages until a signal or -frames N.
 
 #include "camerav4l2.h"
+#include "bayerextract.h"
+#include "temporalfilter.h"
+#include "colorengine.h"
+#include "rawrecorder.h"
+#include "ringrecorder.h"
+#include "framebus.h"
+#include "streamserver.h"
+#include "focusmeter.h"
+#include "changedetector.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 #include <opencv2/imgproc/imgproc.hpp>
-
-// ***********************************************************************
-// ******** Routine to turn buffers of Bayer data into cv::Mats **********
-// ***********************************************************************
-//Macros to assist in Bayer Conversion
-#define B(x,y,w) pDstRGB[0 + 3 * ((x) + (w) * (y))] 
-#define G(x,y,w) pDstRGB[1 + 3 * ((x) + (w) * (y))] 
-#define R(x,y,w) pDstRGB[2 + 3 * ((x) + (w) * (y))] 
-#define IR(x,y,w) pDstIR[0 +     ((x) + (w) * (y))] 
-#define BAY(x,y,w) pSrc[(x) + (w) * (y)]
-#define CLIP(x) ((x) < 0 ? 0 : ((x) >= 255 ? 255 : (x)))
-#define CLIP10(x) ((x) < 0 ? 0 : ((x) >= 1023 ? 1023 : (x)))
-float IRGain[3] = {1.0f, 1.0f, 1.0f};
-
-// Extract 10 bit data from Y16 to 8 bit data RGB8 and IR8
-// No gain is applied and [0..255] of the [0..1023] range is all that is used
-static cv::Point2i ExtractBayerY16toRGB8(cv::Mat &dstRGB,cv::Mat &dstIR, uint8_t * src, int srcLen, cv::Point2i start)
-{
-	cv::Point2i last;
-	unsigned char *pDstRGB;
-	unsigned char *pDstIR;
-	unsigned short *pSrc = (unsigned short*) src;
-	int x,y;
-	int srccnt = 0;	int width = dstRGB.cols;  int height = dstRGB.rows;
-	// itterate 2X2 to de-Bayer and spread out R,G,B elements to RGB and put IR to IR
-	// subtract the IR signal from all other sensor colors
-	unsigned short IRVal;
-	for (y = start.y; (y < height) ; y+=2)
-	{
-		if( srccnt >= srcLen )
-			break;
-		pDstRGB = dstRGB.ptr(y);
-		pDstIR  = dstIR.ptr(y);
-		for (x = start.x; (x < width) ; x+=2)
-		{
-			IRVal = CLIP(BAY(x  ,y+1,width));
-			IR(x,0,width) = IR(x+1,0, width) = IR(x,1,width) = IR(x+1,1,width) = CLIP(IRVal);
-			B(x,0,width)   = B(x+1,0, width) =  B(x,1,width) =  B(x+1,1,width) = CLIP(BAY(x  ,y  ,width) - (int)(IRGain[0] * IRVal));
-			G(x,0,width)   = G(x+1,0, width) =  G(x,1,width) =  G(x+1,1,width) = CLIP(BAY(x+1,y  ,width) - (int)(IRGain[1] * IRVal));
-			R(x,0,width)   = R(x+1,0, width) =  R(x,1,width) =  R(x+1,1,width) = CLIP(BAY(x+1,y+1,width) - (int)(IRGain[2] * IRVal));
-			srccnt+=8;	// used 4 bytes from two rows
-		}
-	}
-	last.x = x; last.y = y;
-	return last;
-}
-// Extract 10 bit data from Y16 to 10 bit data RGB16 and IR16
-// No gain is applied and [0..1023] of the [0..1023] range is all used
-static cv::Point2i ExtractBayerY16toRGB16(cv::Mat &dstRGB,cv::Mat &dstIR, uint8_t * src, int srcLen, cv::Point2i start)
-{
-	cv::Point2i last;
-	unsigned short *pDstRGB;
-	unsigned short *pDstIR;
-	unsigned short *pSrc = (unsigned short*) src;
-	int x,y;
-	int srccnt = 0;
-	int width = dstRGB.cols;  int height = dstRGB.rows;
-	short IRVal;
-	unsigned char * pBuf, *pDst;
-	// itterate 2X2 to de-Bayer and spread out R,G,B elements to RGB and put IR to IR
-	// elements are in Pattern  B G
-	//                         IR R
-	// subtract the IR signal from all other sensor colors
-	// To prevent overflow,  only use 9 bits of raw data 
-	for (y = start.y; (y < height) ; y+=2)
-	{
-		if( srccnt >= srcLen )
-			break;
-		pDstRGB = (unsigned short*)dstRGB.ptr(y);
-		pDstIR  = (unsigned short*)dstIR.ptr(y);
-		for (x = start.x; (x < width) ; x+=2)
-		{
-			IRVal = BAY(x  ,y+1,width);
-			B(x,0,width)   = B(x+1,0, width) =  B(x,1,width) =  B(x+1,1,width) = CLIP10(2*(BAY(x  ,y  ,width) - (int)(IRGain[0] * IRVal)));
-			G(x,0,width)   = G(x+1,0, width) =  G(x,1,width) =  G(x+1,1,width) = CLIP10(2*(BAY(x+1,y  ,width) - (int)(IRGain[1] * IRVal)));
-			R(x,0,width)   = R(x+1,0, width) =  R(x,1,width) =  R(x+1,1,width) = CLIP10(2*(BAY(x+1,y+1,width) - (int)(IRGain[2] * IRVal)));
-			IR(x,0,width) = IR(x+1,0, width) = IR(x,1,width) = IR(x+1,1,width) = CLIP10(2*IRVal);
-			srccnt+=8;	// used 4 bytes from two rows
-		}
-	}
-	last.x = x; last.y = y;
-	return last;
-}
-static cv::Point2i ExtractBayerY16toRGB(cv::Mat &dstRGB, cv::Mat &dstIR, uint8_t * src, int srcLen, cv::Point2i start)
-{
-	cv::Point2i p;
-	int depth = dstRGB.depth();
-	switch (depth)
-	{
-	case 0:
-		p = ExtractBayerY16toRGB8(dstRGB,dstIR, src, srcLen, start);
-		break;
-	case 2:
-		p = ExtractBayerY16toRGB16(dstRGB,dstIR, src, srcLen, start);
-		break;
-	default:
-		break;
-	}
-	return p;
-}
+#ifndef HEADLESS
+#include <opencv2/highgui/highgui.hpp>
+#include "viewfinder.h"
+#include "videoencoder.h"
+#endif
 
 // ********************************************************************************
 // ****  Routine to capture data from buffers into OpenCV Mat objects  ************
@@ -126,15 +47,256 @@ static cv::Point2i ExtractBayerY16toRGB(cv::Mat &dstRGB, cv::Mat &dstIR, uint8_t
 //		cv::Mat  IR(height,width,CV_8UC1);
 // It displays camera images continuously to OpenCV named windows
 // when [anykey] is pressed, CaptureImage() it returns with the images in the cv::Mats
+// [up]/[down] change the exposure by half a stop, [a] turns auto exposure on
+// and off, while it is on [up]/[down] move its target instead
+// The optional processing stages are passed in pStages (NULL members are skipped):
+//	pCal		[d] captures a dark frame (cap the lens first) and [f] a flat
+//				field (uniformly lit target) into it and saves it to calFile
+//	pDefects	[h] learns the hot pixels from dark frames (lens capped)
+//				and saves them to defectFile
+//	pDenoiseRGB, pDenoiseIR  temporal noise filters, [n] turns them on and off
+//	pStats		filled with the statistics of each frame as it is extracted
+//	pColor		grades RGB with its curve and 3D LUT in place of sRGB, [c] turns it on and off
+//	pRecorder	gets every raw buffer before it is touched, [r] starts and stops recording
+//	pRing		holds the last seconds of raw buffers, [t] saves them and the next RING_POST_SECONDS
+//	pBus		gets every finished frame for other processes, the raw plane as defect corrected
+//	pStream		serves the finished frames over HTTP as MJPEG and raw Y16 while clients are connected
+//	pYUVOut		gets each frame as raw 8 bit YUV 4:2:0 (yuvLayout) straight from the raw buffer,
+//				for a video encoder reading a file or pipe; with yuvOnly it is the only extraction
+//	pPyramid	gets RGB and IR at half and quarter resolution as they are extracted for the bus, its
+//				levels go through the same grade or sRGB as the frame but not the temporal denoise
+//	pFocus		measures the sharpness of G and IR on every frame, carried on the bus with the frame,
+//				[z] prints it live while focusing the lens
+//	pChange		skips frames whose raw buffer has not changed since the last processed one: only
+//				the recorder and ring get them, the YUV output repeats its last frame
+//	bin			2 or 4 extracts binned frames (binMode) for low light, 0 for full resolution,
+//				[b] steps through the modes, no pyramid is built while binning
 #define SQRT2 1.414213562F
 #define SQRT2INV 0.707106781F
 #define RGB16 1
-static int CaptureImage(CameraV4L2 *pCap, cv::Mat &RGB, cv::Mat &IR, bool sRGB = true )
+#define CAL_FRAMES 16
+typedef struct
+{
+	BayerCal *pCal;
+	std::string calFile;
+	DefectMap *pDefects;
+	std::string defectFile;
+	TemporalFilter *pDenoiseRGB;
+	TemporalFilter *pDenoiseIR;
+	FrameStats *pStats;
+	ColorEngine *pColor;
+	RawRecorder *pRecorder;
+	RingRecorder *pRing;
+	FrameBus *pBus;
+	StreamServer *pStream;
+	int darkFrames, flatFrames;	// calibration frames still to take
+	int learnFrames;			// defect learning frames still to take
+	FILE *pYUVOut;
+	YUV_LAYOUT yuvLayout;
+	cv::Mat yuv;
+	bool yuvOnly;		// nothing else takes the frames, the YUV pass is the extraction
+	FramePyramid *pPyramid;
+	FocusMeter *pFocus;
+	ChangeDetector *pChange;
+	int bin;
+	BIN_MODE binMode;
+} CAPTURE_STAGES;
+// Name of a new raw recording, CapV4L2-YYYYMMDD-HHMMSS.y16
+static std::string RecordName()
+{
+	char name[64];
+	time_t now = time(NULL);
+	strftime(name, sizeof(name), "CapV4L2-%Y%m%d-%H%M%S.y16", localtime(&now));
+	return name;
+}
+// Save the ring around now to CapV4L2-event-YYYYMMDD-HHMMSS.y16
+static void TriggerRing(RingRecorder *pRing)
+{
+	char name[64];
+	time_t now = time(NULL);
+	strftime(name, sizeof(name), "CapV4L2-event-%Y%m%d-%H%M%S.y16", localtime(&now));
+	if (pRing->Trigger(name) == RingRecorder::OK)
+		fprintf(stderr,"Saving %5.1f s before and %3.1f s after to %s\n", pRing->Before(), RING_POST_SECONDS, name);
+	else if (pRing->Saving())
+		fprintf(stderr,"Event not saved, the last one is still being written\n");
+	else
+		fprintf(stderr,"Event not saved, the ring holds no frames yet\n");
+}
+static void WriteYUV(CAPTURE_STAGES &stages)
+{
+	if (fwrite(stages.yuv.data, stages.yuv.total(), 1, stages.pYUVOut) != 1)
+	{
+		fprintf(stderr,"Error: Writing YUV, stopped\n");
+		stages.pYUVOut = NULL;
+	}
+}
+// Step to the next binning: off, 2x2 and 4x4 averaged, 2x2 and 4x4 summed
+static void NextBinning(CAPTURE_STAGES &stages)
+{
+	if (stages.bin == 0)
+	{
+		stages.bin = 2;
+		stages.binMode = BIN_AVERAGE;
+	}
+	else if (stages.bin == 2)
+		stages.bin = 4;
+	else if (stages.binMode == BIN_AVERAGE)
+	{
+		stages.bin = 2;
+		stages.binMode = BIN_SUM;
+	}
+	else
+		stages.bin = 0;
+	// the sharpness and the denoise history of another binning are not comparable
+	if (stages.pFocus)
+		stages.pFocus->Reset();
+	if (stages.pDenoiseRGB)
+		stages.pDenoiseRGB->Reset();
+	if (stages.pDenoiseIR)
+		stages.pDenoiseIR->Reset();
+	if (stages.bin == 0)
+		fprintf(stderr,"Binning off\n");
+	else
+		fprintf(stderr,"Binning %dx%d %s\n", stages.bin, stages.bin, (stages.binMode == BIN_SUM) ? "summed" : "averaged");
+}
+// Wait for the next frame, extract it into RGB and IR and run it through the stages
+// Returns the buffer length, or FRAME_UNCHANGED when the change detector let the
+// frame go, in which case RGB and IR still hold the last processed frame
+#define FRAME_UNCHANGED 0
+static int NextFrame(CameraV4L2 *pCap, cv::Mat &RGB, cv::Mat &IR, bool sRGB, CAPTURE_STAGES &stages)
+{
+	cv::Point2i start = cv::Point2i(0,0);
+	int bufLen;
+	bool binned = false;
+	do
+	{
+		bufLen = pCap->WaitForFrame();
+		// recorded before defect correction patches the buffer
+		if (stages.pRecorder && stages.pRecorder->Recording() && (bufLen > 0))
+			stages.pRecorder->Push(pCap->Buffer(), bufLen, pCap->Sequence(), pCap->Timestamp(), pCap->Exposure());
+		if (stages.pRing && stages.pRing->Ready() && (bufLen > 0))
+			stages.pRing->Push(pCap->Buffer(), bufLen, pCap->Sequence(), pCap->Timestamp(), pCap->Exposure());
+		// calibration needs every frame
+		if ((start.y == 0) && stages.pChange && stages.pChange->Ready()
+			&& (stages.darkFrames + stages.flatFrames + stages.learnFrames == 0)
+			&& !stages.pChange->Test(pCap->Buffer(), bufLen))
+		{
+			if (stages.pYUVOut && !stages.yuv.empty())
+				WriteYUV(stages);
+			return FRAME_UNCHANGED;
+		}
+		if ((start.y == 0) && stages.pStats)
+			stages.pStats->Reset();
+		if (stages.yuvOnly)
+		{
+			stages.yuv.create(RGB.rows * 3 / 2, RGB.cols, CV_8UC1);
+			cv::Mat noIR;
+			start = ExtractBayerY16toYUV420(stages.yuv, noIR, stages.yuvLayout, pCap->Buffer(), bufLen, start,
+											TransferTable::Get(TransferTable::CURVE_SRGB, pCap->InputRange(), 8),
+											stages.pCal, (stages.learnFrames > 0) ? NULL : stages.pDefects, stages.pStats);
+			continue;
+		}
+		// defects are left in the buffer while they are being learned
+		if ((stages.bin > 0) && (start.y == 0)
+			&& ExtractBayerY16toRGBBinned(RGB, IR, stages.bin, stages.binMode, pCap->Buffer(), bufLen, RGB.cols, RGB.rows,
+										  stages.pCal, (stages.learnFrames > 0) ? NULL : stages.pDefects, stages.pStats))
+		{
+			binned = true;
+			break;
+		}
+		start = ExtractBayerY16toRGB(RGB, IR, pCap->Buffer(), bufLen, start,
+									 stages.pCal, (stages.learnFrames > 0) ? NULL : stages.pDefects, stages.pStats,
+									 stages.pPyramid);
+	} while (start.y < RGB.rows);
+	if (stages.pYUVOut && !stages.yuvOnly)
+	{
+		// the defects are already patched in the buffer, white is the camera's input range as for the planes
+		cv::Mat noIR;
+		stages.yuv.create(RGB.rows * 3 / 2, RGB.cols, CV_8UC1);
+		ExtractBayerY16toYUV420(stages.yuv, noIR, stages.yuvLayout, pCap->Buffer(), bufLen, cv::Point2i(0,0),
+								TransferTable::Get(TransferTable::CURVE_SRGB, pCap->InputRange(), 8), stages.pCal);
+	}
+	if (stages.pYUVOut)
+		WriteYUV(stages);
+	if (stages.learnFrames > 0)
+	{
+		stages.pDefects->AddLearn(pCap->Buffer(), bufLen);
+		if ((--stages.learnFrames == 0) && (stages.pDefects->EndLearn() == DefectMap::OK))
+			stages.pDefects->Save(stages.defectFile);
+	}
+	if (stages.darkFrames > 0)
+	{
+		stages.pCal->AddDark(pCap->Buffer(), bufLen);
+		if ((--stages.darkFrames == 0) && (stages.pCal->EndDark() == BayerCal::OK))
+			stages.pCal->Save(stages.calFile);
+	}
+	if (stages.flatFrames > 0)
+	{
+		stages.pCal->AddFlat(pCap->Buffer(), bufLen);
+		if ((--stages.flatFrames == 0) && (stages.pCal->EndFlat() == BayerCal::OK))
+			stages.pCal->Save(stages.calFile);
+	}
+	if (pCap->AutoExposure())
+	{
+		if (stages.pStats)
+			pCap->UpdateAutoExposure(*stages.pStats);
+		else
+			pCap->UpdateAutoExposure(pCap->Buffer(), bufLen);
+	}
+	if (stages.yuvOnly)
+		return bufLen;
+	// the filters take 10 bit planes, summed bins reach 14 bits and pass through
+	bool summed = binned && (stages.binMode == BIN_SUM);
+	if (stages.pDenoiseRGB && !summed)
+		stages.pDenoiseRGB->Apply(RGB);
+	if (stages.pDenoiseIR && !summed)
+		stages.pDenoiseIR->Apply(IR);
+	// on the linear planes, before any grade; binned planes repeat each bin
+	// and summed ones overflow the meter, so focus waits for full resolution
+	float sharpness[FocusMeter::FOCUS_CHANNELS];
+	float *pSharpness = NULL;
+	if (stages.pFocus && !binned && (stages.pFocus->Measure(RGB, IR) == FocusMeter::OK))
+	{
+		sharpness[FocusMeter::FOCUS_G] = stages.pFocus->Sharpness(FocusMeter::FOCUS_G);
+		sharpness[FocusMeter::FOCUS_IR] = stages.pFocus->Sharpness(FocusMeter::FOCUS_IR);
+		pSharpness = sharpness;
+	}
+	
+	bool grade = stages.pColor && stages.pColor->Enabled();
+	// level 0 is graded even when the pyramid could not be laid out
+	int levels = (stages.pPyramid && !binned) ? stages.pPyramid->Levels() : 1;
+	levels = (levels < 1) ? 1 : levels;
+	for (int level = 0; level < levels; level++)
+	{
+		cv::Mat &rgb = (level > 0) ? stages.pPyramid->LevelRGB(level) : RGB;
+		cv::Mat &ir = (level > 0) ? stages.pPyramid->LevelIR(level) : IR;
+		if (grade)
+		{
+			stages.pColor->Apply(rgb,rgb);
+			if (sRGB)
+				pCap->ConvertTosRGB(ir,ir);
+		}
+		else if (sRGB)
+		{
+			// in place, the linear frame is not needed after this
+			pCap->ConvertTosRGB(rgb,rgb);
+			pCap->ConvertTosRGB(ir,ir);
+		}
+	}
+	if (stages.pBus && stages.pBus->IsOpen())
+		stages.pBus->Publish(pCap->Buffer(), bufLen, RGB, IR, pCap->Sequence(), pCap->Timestamp(), pCap->Exposure(), pSharpness,
+							 binned ? NULL : stages.pPyramid);
+	// graded and sRGB frames fill 16 bits, linear ones hold the sensor range
+	if (stages.pStream)
+		stages.pStream->Post(RGB, pCap->Buffer(), bufLen, RGB.cols, RGB.rows, pCap->Sequence(),
+							 (grade || sRGB) ? 65536 : pCap->InputRange());
+	return bufLen;
+}
+#ifndef HEADLESS
+static int CaptureImage(CameraV4L2 *pCap, cv::Mat &RGB, cv::Mat &IR, bool sRGB = true, CAPTURE_STAGES *pStages = NULL)
 {
 	int height = RGB.rows;
 	int width = RGB.cols;
-	cv::Point2i start = cv::Point2i(0,0);
-	int bufLen; 
 //	std::string videoName("/tmp/Viewfinder.avi");
 	std::string videoName("/tmp/Viewfinder.avi/");
 //	std::string videoName("http://localhost/feed1.ffm/");
@@ -143,46 +305,47 @@ static int CaptureImage(CameraV4L2 *pCap, cv::Mat &RGB, cv::Mat &IR, bool sRGB =
 	int viewWidth = width/2; int viewHeight = height/2;
 	viewWidth += (viewWidth % 16);  viewHeight += (16-viewHeight % 16);
 	cv::Size frameSize(viewWidth,viewHeight);
-	cv::Mat ViewMat(viewHeight,viewWidth,RGB.type());
 	bool isColor = true;
-	cv::VideoWriter outputVideo;
-	outputVideo.open(videoName, fourcc, fps, frameSize,isColor);
+	// frames are copied into the encoder's queue, then scaled and encoded on its thread, dropped if it falls behind
+	VideoEncoder outputVideo(ENCODE_QUEUE, VideoEncoder::ENCODE_DROP);
+	outputVideo.Open(videoName, fourcc, fps, frameSize, RGB.type(), isColor);
 
-	bool status = outputVideo.isOpened();
-	cv::Mat xRGB(RGB.size(),RGB.type());
-	cv::Mat xIR(IR.size(),IR.type());
+	CAPTURE_STAGES none = {NULL, "", NULL, "", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0};
+	CAPTURE_STAGES &stages = pStages ? *pStages : none;
+	BayerCal *pCal = stages.pCal;
+	DefectMap *pDefects = stages.pDefects;
+	// windows are drawn on their own thread at VIEW_REFRESH_HZ
+	Viewfinder view;
+	view.Start();
  	pCap->Start();
 	int key = -1;
+	bool focusLive = false;	// [z] focus readout
+	unsigned int frames = 0;
 	while (key == -1)	// anykey to exit
 	{
-		do
-		{
-			bufLen = pCap->WaitForFrame();
-			start = ExtractBayerY16toRGB(xRGB, xIR, pCap->Buffer(), bufLen, start);
-		} while (start.y < height);
-		start = cv::Point2i(0,0);	// restart capture for next loop
-		
-		if (sRGB)
+		if (NextFrame(pCap, RGB, IR, sRGB, stages) != FRAME_UNCHANGED)
 		{
-			pCap->ConvertTosRGB(xRGB,RGB);
-			pCap->ConvertTosRGB(xIR,IR);
+			if (focusLive && ((++frames % FOCUS_AVERAGE) == 0))
+				fprintf(stderr,"Focus G %8.1f (peak %8.1f)  IR %8.1f (peak %8.1f)\r",
+						stages.pFocus->Average(FocusMeter::FOCUS_G), stages.pFocus->Peak(FocusMeter::FOCUS_G),
+						stages.pFocus->Average(FocusMeter::FOCUS_IR), stages.pFocus->Peak(FocusMeter::FOCUS_IR));
+			view.Post(RGB, IR);	// copied only when the display is ready for a frame
+			outputVideo.Push(RGB);	// never waits for the encoder
 		}
-		std::vector<cv::Mat> plane;
-		cv::split(RGB,plane);
-		cv::imshow("frameB",plane[0]);
-		cv::imshow("frameG",plane[1]);
-		cv::imshow("frameR",plane[2]);
-		cv::imshow("frameRGB",RGB);	// viewfinder displays
-		cv::imshow("frameIR",IR);
-		
-		cv::resize(RGB,ViewMat,ViewMat.size(),0,0, CV_INTER_NN);
-		outputVideo << ViewMat;
-		key = cv::waitKey(20);	// catch key
+		else
+			outputVideo.Push(RGB);	// the held frame again, the video runs at a fixed rate
+		key = view.Key();	// catch key
 		if(key == -1) continue;
 		int current;
 		switch (key)
 		{
 		case 1113938:
+			if (pCap->AutoExposure())
+			{
+				pCap->SetAETarget(pCap->AETarget() * SQRT2);
+				key = -1;
+				break;
+			}
 			// increase exposure by 1/2 stop
 			current = pCap->GetExposure();
 			if (current >= 0)
@@ -194,6 +357,12 @@ static int CaptureImage(CameraV4L2 *pCap, cv::Mat &RGB, cv::Mat &IR, bool sRGB =
 			key = -1;
 			break;
 		case 1113940:
+			if (pCap->AutoExposure())
+			{
+				pCap->SetAETarget(pCap->AETarget() * SQRT2INV);
+				key = -1;
+				break;
+			}
 			// decrease exposure by half stop
 			current = pCap->GetExposure();
 			if(current >= 0)
@@ -204,14 +373,182 @@ static int CaptureImage(CameraV4L2 *pCap, cv::Mat &RGB, cv::Mat &IR, bool sRGB =
 			key = -1;
 			break;
 		default:
+			if (pCal && ((key & 0xffff) == 'd') && (stages.darkFrames + stages.flatFrames == 0))
+			{
+				// the raw buffer is accumulated so the current calibration does not bias it
+				if (!pCal->Matches(width, height))
+					pCal->SetSize(width, height);
+				pCal->BeginDark();
+				stages.darkFrames = CAL_FRAMES;
+				key = -1;
+			}
+			else if (pCal && ((key & 0xffff) == 'f') && (stages.darkFrames + stages.flatFrames == 0))
+			{
+				// keep the dark frame, the flat is measured relative to it
+				if (!pCal->Matches(width, height))
+					pCal->SetSize(width, height);
+				pCal->ClearFlat();
+				pCal->BeginFlat();
+				stages.flatFrames = CAL_FRAMES;
+				key = -1;
+			}
+			else if (pDefects && ((key & 0xffff) == 'h') && (stages.learnFrames == 0))
+			{
+				pDefects->SetSize(width, height);
+				pDefects->BeginLearn();
+				stages.learnFrames = CAL_FRAMES;
+				key = -1;
+			}
+			else if ((key & 0xffff) == 'a')
+			{
+				// keep the target [+]/[-] moved it to
+				pCap->SetAutoExposure(!pCap->AutoExposure(), pCap->AETarget(), pCap->AEInterval(), pCap->AEMeter());
+				fprintf(stderr,"Auto exposure %s\n", pCap->AutoExposure() ? "on" : "off");
+				if (!pCap->AutoExposure())
+					fprintf(stderr,"Last AE convergence %5.2f s\n", pCap->AEConvergenceTime());
+				key = -1;
+			}
+			else if (stages.pRecorder && ((key & 0xffff) == 'r'))
+			{
+				if (stages.pRecorder->Recording())
+				{
+					stages.pRecorder->Close();
+					fprintf(stderr,"Recorded %u frames\n", stages.pRecorder->Frames());
+				}
+				else if (stages.pRecorder->Open(RecordName(), width, height) == RawRecorder::OK)
+					fprintf(stderr,"Recording raw frames\n");
+				key = -1;
+			}
+			else if (stages.pRing && stages.pRing->Ready() && ((key & 0xffff) == 't'))
+			{
+				TriggerRing(stages.pRing);
+				key = -1;
+			}
+			else if (stages.pColor && ((key & 0xffff) == 'c'))
+			{
+				stages.pColor->Enable(!stages.pColor->Enabled());
+				fprintf(stderr,"Color grade %s\n", stages.pColor->Enabled() ? "on" : "off");
+				key = -1;
+			}
+			else if (stages.pDenoiseRGB && stages.pDenoiseIR && ((key & 0xffff) == 'n'))
+			{
+				stages.pDenoiseRGB->Enable(!stages.pDenoiseRGB->Enabled());
+				stages.pDenoiseIR->Enable(stages.pDenoiseRGB->Enabled());
+				fprintf(stderr,"Temporal denoise %s\n", stages.pDenoiseRGB->Enabled() ? "on" : "off");
+				key = -1;
+			}
+			else if (stages.pFocus && ((key & 0xffff) == 'z'))
+			{
+				// each focusing session starts its own peak
+				focusLive = !focusLive;
+				stages.pFocus->Reset();
+				fprintf(stderr,"\nFocus readout %s\n", focusLive ? "on" : "off");
+				key = -1;
+			}
+			else if ((key & 0xffff) == 'b')
+			{
+				NextBinning(stages);
+				key = -1;
+			}
 			break;
 		}
 	}	// while(key)
 	
-	outputVideo.release();
+	if (outputVideo.IsOpen())
+	{
+		outputVideo.Close();
+		outputVideo.PrintStats();
+	}
+	view.Stop();
 	pCap->Stop();
     return 0;
 }
+#endif // HEADLESS
+
+// ********************************************************************************
+// ****  Headless capture, no windows or video, for capture nodes without X  *****
+// ********************************************************************************
+// CaptureHeadless() runs the frames through the stages like CaptureImage() until
+// SIGINT/SIGTERM arrives or, when frames > 0, that many frames are done.
+// Every STATS_FRAMES frames the rate, the channel means and the sharpness go to
+// stderr, with a warning while the sharpness is well below its best.
+// SIGUSR1 saves the ring around now when there is one, SIGUSR2 steps the binning.
+#define STATS_FRAMES 100
+static volatile sig_atomic_t s_Stop = 0;
+static volatile sig_atomic_t s_Trigger = 0;
+static volatile sig_atomic_t s_Binning = 0;
+static void OnStopSignal(int sig)
+{
+	s_Stop = 1;
+}
+static void OnTriggerSignal(int sig)
+{
+	s_Trigger = 1;
+}
+static void OnBinningSignal(int sig)
+{
+	s_Binning = 1;
+}
+static double Seconds()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+static int CaptureHeadless(CameraV4L2 *pCap, cv::Mat &RGB, cv::Mat &IR, bool sRGB = false, CAPTURE_STAGES *pStages = NULL,
+						   int frames = 0)
+{
+	CAPTURE_STAGES none = {NULL, "", NULL, "", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0};
+	CAPTURE_STAGES &stages = pStages ? *pStages : none;
+	signal(SIGINT, OnStopSignal);
+	signal(SIGTERM, OnStopSignal);
+	signal(SIGUSR1, OnTriggerSignal);
+	signal(SIGUSR2, OnBinningSignal);
+	pCap->Start();
+	int count = 0;
+	double begin = Seconds();
+	double mark = begin;
+	double now;
+	while (!s_Stop && ((frames <= 0) || (count < frames)))
+	{
+		NextFrame(pCap, RGB, IR, sRGB, stages);
+		if (s_Trigger)
+		{
+			s_Trigger = 0;
+			if (stages.pRing && stages.pRing->Ready())
+				TriggerRing(stages.pRing);
+		}
+		if (s_Binning)
+		{
+			s_Binning = 0;
+			NextBinning(stages);
+		}
+		if ((++count % STATS_FRAMES) == 0)
+		{
+			now = Seconds();
+			if (stages.pStats)
+				fprintf(stderr,"%d frames %6.1f fps  B %6.1f G %6.1f IR %6.1f R %6.1f\n", count, STATS_FRAMES / (now - mark),
+						stages.pStats->Mean(FrameStats::FS_B), stages.pStats->Mean(FrameStats::FS_G),
+						stages.pStats->Mean(FrameStats::FS_IR), stages.pStats->Mean(FrameStats::FS_R));
+			else
+				fprintf(stderr,"%d frames %6.1f fps\n", count, STATS_FRAMES / (now - mark));
+			if (stages.pFocus && (stages.pFocus->Frames() > 0))
+				fprintf(stderr,"  focus G %8.1f IR %8.1f%s\n", stages.pFocus->Average(FocusMeter::FOCUS_G),
+						stages.pFocus->Average(FocusMeter::FOCUS_IR), stages.pFocus->Drifted() ? "  drifted from its peak" : "");
+			if (stages.pChange && stages.pChange->Ready())
+				fprintf(stderr,"  unchanged %u of %u frames\n", stages.pChange->Skipped(), stages.pChange->Tested());
+			mark = now;
+		}
+	}
+	pCap->Stop();
+	now = Seconds();
+	fprintf(stderr,"Captured %d frames in %5.1f s\n", count, now - begin);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGUSR1, SIG_DFL);
+	signal(SIGUSR2, SIG_DFL);
+	return 0;
+}
 
 // *************************************************************************
 // **************  Main For Testing  ***************************************
@@ -222,12 +559,69 @@ static int CaptureImage(CameraV4L2 *pCap, cv::Mat &RGB, cv::Mat &IR, bool sRGB =
 int main(int argc, char* argv[])
 {
 	int width = 672; int height = 380;
-	if (argc > 1)
+	// CapV4L2 [WxH] [-headless] [-frames N] [-record file.y16] [-compress] [-ring MB] [-bus name] [-stream port] [-yuv file|-] [-nv12] [-pyramid levels] [-focus x,y,w,h] [-change level] [-bin 2|4] [-binsum]
+#ifdef HEADLESS
+	bool headless = true;	// built without highgui
+#else
+	bool headless = false;
+#endif
+	int frames = 0;	// headless frames to capture, 0 until a signal
+	std::string recordFile;	// headless raw recording
+	bool compress = false;	// lossless coding of recordings and the ring
+	int ringMB = 0;			// pre-trigger ring, 0 for none
+	std::string busName;	// shared memory frame bus for local readers
+	int streamPort = 0;		// HTTP preview, 0 for none
+	std::string yuvFile;	// raw YUV 4:2:0 frames, - for stdout
+	bool nv12 = false;		// else I420
+	int pyramidLevels = 0;	// including the frame, 0 for no pyramid
+	cv::Rect focusROI;		// empty for the centre half
+	int changeLevel = 0;	// skip unchanged frames, 0 to process them all
+	int bin = 0;			// low light binning, 0 for full resolution
+	bool binSum = false;	// else averaged
+	for (int arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "-headless") == 0)
+			headless = true;
+		else if ((strcmp(argv[arg], "-frames") == 0) && (arg + 1 < argc))
+			frames = atoi(argv[++arg]);
+		else if ((strcmp(argv[arg], "-record") == 0) && (arg + 1 < argc))
+			recordFile = argv[++arg];
+		else if (strcmp(argv[arg], "-compress") == 0)
+			compress = true;
+		else if ((strcmp(argv[arg], "-ring") == 0) && (arg + 1 < argc))
+			ringMB = atoi(argv[++arg]);
+		else if ((strcmp(argv[arg], "-bus") == 0) && (arg + 1 < argc))
+			busName = argv[++arg];
+		else if ((strcmp(argv[arg], "-stream") == 0) && (arg + 1 < argc))
+			streamPort = atoi(argv[++arg]);
+		else if ((strcmp(argv[arg], "-yuv") == 0) && (arg + 1 < argc))
+			yuvFile = argv[++arg];
+		else if (strcmp(argv[arg], "-nv12") == 0)
+			nv12 = true;
+		else if ((strcmp(argv[arg], "-pyramid") == 0) && (arg + 1 < argc))
+			pyramidLevels = atoi(argv[++arg]);
+		else if ((strcmp(argv[arg], "-focus") == 0) && (arg + 1 < argc))
+			sscanf(argv[++arg], "%d,%d,%d,%d", &focusROI.x, &focusROI.y, &focusROI.width, &focusROI.height);
+		else if ((strcmp(argv[arg], "-change") == 0) && (arg + 1 < argc))
+			changeLevel = atoi(argv[++arg]);
+		else if ((strcmp(argv[arg], "-bin") == 0) && (arg + 1 < argc))
+			bin = atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "-binsum") == 0)
+			binSum = true;
+		else
+			sscanf(argv[arg], "%dx%d", &width, &height);
+	}
+	// YUV to stdout, e.g. | ffmpeg -f rawvideo -pix_fmt yuv420p -s WxH -i - ...
+	// the camera's messages go to stderr so they stay out of the stream
+	FILE *yuvOut = NULL;
+	if (yuvFile == "-")
 	{
-		char* argstring0 = argv[0];
-		char* argstring1 = argv[1];
-		sscanf(argv[1], "%dx%d", &width, &height);
+		int fd = dup(1);
+		dup2(2, 1);
+		yuvOut = fdopen(fd, "wb");
 	}
+	else if (!yuvFile.empty() && ((yuvOut = fopen(yuvFile.data(), "wb")) == NULL))
+		fprintf(stderr, "Unable to write %s\n", yuvFile.data());
 	CameraV4L2 cam("/dev/video0",512);
 	if(!cam.Exists())
 	{
@@ -243,6 +637,67 @@ int main(int argc, char* argv[])
         return 1;
 	if(cam.RequestBuffers(1))
 		return 1;
+	// black level / dark frame / flat field for this camera if it has been calibrated
+	std::string calFile = "CapV4L2-" + cam.BusInfo() + ".cal";
+	BayerCal cal;
+	if (cal.Load(calFile) != BayerCal::OK)
+		cal.SetSize(width, height);
+	std::string defectFile = "CapV4L2-" + cam.BusInfo() + ".dpm";
+	DefectMap defects;
+	if (defects.Load(defectFile) != DefectMap::OK)
+		defects.SetSize(width, height);
+	// temporal denoise starts off, [n] in the viewfinder toggles it
+	TemporalFilter denoiseRGB, denoiseIR;
+	FrameStats stats;
+	// color grade: sRGB curve then the camera's 3D LUT if there is one
+	ColorEngine color;
+	color.SetCurve(TransferTable::Get(TransferTable::CURVE_SRGB, RGB16 ? cam.InputRange() : 256, 16));
+	color.Enable(color.LoadCube("CapV4L2-" + cam.BusInfo() + ".cube") == ColorEngine::OK);
+	CAPTURE_STAGES stages;
+	stages.pCal = &cal;
+	stages.calFile = calFile;
+	stages.pDefects = &defects;
+	stages.defectFile = defectFile;
+	stages.pDenoiseRGB = &denoiseRGB;
+	stages.pDenoiseIR = &denoiseIR;
+	stages.pStats = &stats;
+	stages.pColor = &color;
+	// raw Y16 recording, [r] in the viewfinder or -record when headless
+	RawRecorder recorder;
+	recorder.Compress(compress);
+	if (!recordFile.empty())
+		recorder.Open(recordFile, width, height);
+	stages.pRecorder = &recorder;
+	// event capture, [t] in the viewfinder or SIGUSR1 when headless
+	RingRecorder ring;
+	if (ringMB > 0)
+		ring.Setup(width, height, (size_t)ringMB << 20, compress);
+	stages.pRing = &ring;
+	stages.darkFrames = stages.flatFrames = stages.learnFrames = 0;
+	stages.pYUVOut = yuvOut;
+	stages.yuvLayout = nv12 ? YUV_NV12 : YUV_I420;
+	// reduced frames for the analytics on the bus, built by the extraction
+	FramePyramid pyramid;
+	stages.pPyramid = NULL;
+	if ((pyramidLevels > 1) && busName.empty())
+		fprintf(stderr,"The pyramid is only built for the bus, -pyramid needs -bus\n");
+	pyramidLevels = (pyramidLevels > BUS_LEVELS) ? BUS_LEVELS : pyramidLevels;
+	if ((pyramidLevels > 1) && !busName.empty() && (pyramid.SetLevels(pyramidLevels) == FramePyramid::OK))
+		stages.pPyramid = &pyramid;
+	FocusMeter focus;
+	focus.SetROI(focusROI);
+	stages.pFocus = &focus;
+	// static scenes only cost the raw sinks and the test
+	ChangeDetector change;
+	stages.pChange = NULL;
+	if ((changeLevel > 0) && (change.Setup(width, height) == ChangeDetector::OK))
+	{
+		change.SetThreshold(changeLevel);
+		stages.pChange = &change;
+	}
+	// night mode, [b] in the viewfinder or SIGUSR2 when headless change it on the fly
+	stages.bin = ((bin == 2) || (bin == 4)) ? bin : 0;
+	stages.binMode = binSum ? BIN_SUM : BIN_AVERAGE;
 	
 	cv::Mat frameRGB;
 	cv::Mat frameIR;
@@ -256,12 +711,35 @@ int main(int argc, char* argv[])
 		frameRGB.create(height, width, CV_8UC3);
 		frameIR.create(height, width, CV_8UC1);
 	}
-    if(CaptureImage(&cam, frameRGB, frameIR))
+	// other processes on this machine see every frame through the bus
+	FrameBus bus;
+	if (!busName.empty())
+		bus.Create(busName, width, height, BUS_ALL | (stages.pPyramid ? BUS_PYRAMID : 0), frameRGB.depth());
+	stages.pBus = &bus;
+	if (!bus.IsOpen())
+		stages.pPyramid = NULL;
+	// HMIs and browsers on the network, one encode per frame for all of them
+	StreamServer stream;
+	stages.pStream = NULL;
+	if ((streamPort > 0) && (stream.Start(streamPort) == StreamServer::OK))
+		stages.pStream = &stream;
+	// a headless run feeding only the YUV output extracts straight to it and skips the planes,
+	// binning and the focus meter with them
+	stages.yuvOnly = headless && (yuvOut != NULL) && !bus.IsOpen() && (stages.pStream == NULL)
+					 && (stages.pPyramid == NULL) && (focusROI.area() == 0);
+	if (headless)
+	{
+		// nobody is watching, the sinks take the linear frames
+		return CaptureHeadless(&cam, frameRGB, frameIR, false, &stages, frames);
+	}
+#ifndef HEADLESS
+    if(CaptureImage(&cam, frameRGB, frameIR, true, &stages))
         return 1;
 	
 	printf ("saving images\n");
 	cv::imwrite("/home/frank/Pictures/RGB.png",frameRGB);
 	cv::imwrite("/home/frank/Pictures/IR.png",frameIR);
+#endif
 	
     return 0;
 }
\ No newline at end of file
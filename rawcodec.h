@@ -0,0 +1,84 @@
+#ifndef RAWCODEC_HEADER
+#define RAWCODEC_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "threadpool.h"
+
+// RawCodec losslessly compresses Y16 raw frames of the See3CAM_CU40
+// mosaic		B G
+//				IR R
+// Each site is predicted from the same colour sites of the 2x2 lattice
+// (left x-2, up y-2 and up-left, LOCO-I median predictor) and the
+// residual is Golomb-Rice coded with a parameter adapted per channel and
+// local activity.  Frames are cut into strips of rows coded on their own
+// on a thread pool, ThreadPool::Shared() unless one is given.  A strip that would not shrink is stored
+// packed to the significant bits, and one holding samples above them is
+// stored as plain Y16, so any buffer round trips exactly.
+//
+// Coded frame:	CODEC_HEADER, strips x uint32 strip bytes, then the strips,
+// each a mode byte (CODEC_STRIP_MODE) followed by its data and
+// CODEC_PAD zero bytes.
+#define CODEC_MAGIC "CV4C"
+#define CODEC_STRIP_ROWS 32		// rows per strip, even
+#define CODEC_RICE_LIMIT 24		// longest unary prefix before an escape
+#define CODEC_PAD 8				// zero bytes after each strip for the bit reader
+
+typedef struct
+{
+	char magic[4];		// CODEC_MAGIC
+	uint32_t width;
+	uint32_t height;
+	uint32_t bits;		// significant bits of the samples
+	uint32_t stripRows;
+	uint32_t strips;
+	uint32_t bytes;		// of the whole coded frame
+} CODEC_HEADER;
+
+class RawCodec
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+	typedef enum strip_modes
+	{
+		CODEC_RICE = 0,
+		CODEC_PACKED,		// bits per sample, no prediction
+		CODEC_Y16			// as captured
+	} CODEC_STRIP_MODE;
+
+	RawCodec(int bits = 10, int stripRows = CODEC_STRIP_ROWS, ThreadPool *pPool = NULL);
+	~RawCodec();
+	int MaxBytes(int width, int height);	// largest coded frame
+	// returns the coded bytes or -1, one frame at a time per RawCodec
+	int Encode(const uint8_t *src, int width, int height, uint8_t *dst, int dstLen);
+	ERR Decode(const uint8_t *src, int srcLen, uint8_t *dst, int dstLen);
+	static ERR Info(const uint8_t *src, int srcLen, int &width, int &height, int &bytes);
+	// one strip, for the thread pool
+	void EncodeStrip(int strip);
+	void DecodeStrip(int strip);
+
+private:
+	int StripBytes(int rows){return 1 + rows * m_Width * 2 + CODEC_PAD;};	// room for the worst case
+	int EncodeRice(const uint16_t *pSrc, int rows, uint8_t *pDst);	// -1 if a sample is out of range
+	int EncodePacked(const uint16_t *pSrc, int count, uint8_t *pDst);
+	ERR DecodeRice(const uint8_t *pSrc, int srcLen, uint16_t *pDst, int rows);
+	ERR DecodePacked(const uint8_t *pSrc, int srcLen, uint16_t *pDst, int count);
+
+	int m_Bits;
+	int m_StripRows;
+	ThreadPool *m_pPool;	// not owned
+	// the frame in progress
+	int m_Width, m_Height, m_Strips;
+	const uint8_t *m_pSrc;
+	uint8_t *m_pDst;
+	std::vector<uint8_t> m_Scratch;		// each strip coded at a fixed place
+	std::vector<int> m_StripBytes;
+	std::vector<const uint8_t *> m_StripData;	// decoding
+	volatile int m_Failed;
+};
+
+#endif // RAWCODEC_HEADER
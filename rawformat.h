@@ -0,0 +1,64 @@
+#ifndef RAWFORMAT_HEADER
+#define RAWFORMAT_HEADER
+#include <stdint.h>
+
+// Raw recording container written by RawRecorder and read by RawReader.
+// All fields are little endian, offsets are from the start of the file.
+//
+//	0							RAW_HEADER, padded to RECORD_ALIGN bytes
+//	RECORD_ALIGN + i * stride	frame i, frameBytes of Y16 then zero padding
+//								to stride (a multiple of RECORD_ALIGN)
+//	indexOffset					frames x RAW_ENTRY, then padding
+//
+// With RAW_CODEC_RICE each slot holds one RawCodec frame padded to
+// RECORD_ALIGN, so slots differ in size and are found through the index
+// (or, without one, by walking the coded frame headers).
+// Frame slots are page aligned so a reader can mmap the file and use a
+// frame in place.  The index is written when the recording is closed;
+// until then indexOffset is 0 and the frame count follows from the file
+// size (the text sidecar <file>.idx has the timestamps as they arrive).
+#define RECORD_ALIGN 4096	// O_DIRECT block size, header size and frame alignment
+#define RAW_MAGIC "CV4R"
+#define RAW_VERSION 1
+
+typedef enum
+{
+	RAW_CFA_BGIRR = 0	// See3CAM_CU40		B G / IR R
+} RAW_CFA;
+
+typedef enum
+{
+	RAW_CODEC_NONE = 0,		// Y16 as captured
+	RAW_CODEC_RICE,			// RawCodec frames, slots sized to each frame
+	RAW_CODECS
+} RAW_CODEC;
+
+typedef struct
+{
+	char magic[4];			// RAW_MAGIC
+	uint32_t version;		// RAW_VERSION
+	uint32_t headerBytes;	// RECORD_ALIGN, frame 0 starts here
+	uint32_t width;			// sites
+	uint32_t height;
+	uint32_t cfa;			// RAW_CFA
+	uint32_t bits;			// significant bits of each Y16 sample
+	uint32_t frameBytes;	// Y16 bytes of a whole frame
+	uint32_t stride;		// bytes from one frame slot to the next
+	uint32_t frames;		// in the index, 0 until closed
+	uint64_t indexOffset;	// 0 until closed
+	uint32_t codec;			// RAW_CODEC of the frame slots, after the original fields
+							// so recordings made before it read as RAW_CODEC_NONE
+} RAW_HEADER;
+
+typedef struct
+{
+	uint32_t sequence;		// from the driver
+	int32_t exposure;		// 1/10 ms, -1 if unknown
+	int64_t seconds;		// driver timestamp
+	int64_t microseconds;
+	uint64_t offset;		// of the frame slot
+	uint32_t bytes;			// of data in the slot
+	uint32_t reserved;
+} RAW_ENTRY;
+
+#endif // RAWFORMAT_HEADER
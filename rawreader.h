@@ -0,0 +1,61 @@
+#ifndef RAWREADER_HEADER
+#define RAWREADER_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "rawformat.h"
+#include "rawcodec.h"
+
+// RawReader maps a recording made by RawRecorder (see rawformat.h) and
+// hands out frames in place, by index or by timestamp, without reading
+// the file through.  The mapping is private and writable so a frame can
+// go straight into ExtractBayerY16toRGB(), whose defect correction
+// patches the buffer: only the pages it touches are copied, the file is
+// never changed.  A recording that was not closed has no index; its
+// frames are still there, but without timestamps.  Compressed recordings
+// hand out the coded frames; Decode() expands one into a cv::Mat.
+class RawReader
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	RawReader();
+	~RawReader();
+	ERR Open(std::string fileName);
+	void Close();
+	bool IsOpen(){return m_pMap != NULL;};
+	int Frames(){return m_Frames;};
+	int Width(){return m_pHeader ? (int)m_pHeader->width : 0;};
+	int Height(){return m_pHeader ? (int)m_pHeader->height : 0;};
+	int Bits(){return m_pHeader ? (int)m_pHeader->bits : 0;};
+	bool Indexed(){return m_pIndex != NULL;};
+	bool Compressed(){return m_pHeader && (m_pHeader->codec != RAW_CODEC_NONE);};
+	// Y16 buffer of frame i as the camera delivered it (coded if Compressed()), NULL if out of range
+	uint8_t *Frame(int i, int *pLen = NULL);
+	cv::Mat View(int i);	// CV_16UC1 header over the frame, empty if out of range or compressed
+	ERR Decode(int i, cv::Mat &dst);	// into a CV_16UC1 frame, for any recording
+	ERR Entry(int i, RAW_ENTRY &entry);	// FAIL without an index
+	int Find(struct timeval t);	// last frame at or before t, -1 if none
+	int FindSequence(uint32_t sequence);	// -1 if not recorded
+	void Prefetch(int i, int count = 1);	// start reading frames ahead of use
+
+private:
+	uint8_t *m_pMap;
+	size_t m_Size;
+	const RAW_HEADER *m_pHeader;
+	const RAW_ENTRY *m_pIndex;
+	int m_Frames;
+	// coded frames found without an index
+	std::vector<uint64_t> m_Offsets;
+	std::vector<uint32_t> m_Bytes;
+	RawCodec *m_pCodec;
+};
+
+#endif // RAWREADER_HEADER
@@ -0,0 +1,91 @@
+#ifndef RAWRECORDER_HEADER
+#define RAWRECORDER_HEADER
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+#include "rawformat.h"
+#include "rawcodec.h"
+#include "threadpool.h"
+
+// RawRecorder writes the untouched Y16 buffers of the camera to disk for
+// offline re-processing, in the container described in rawformat.h.
+// Push() copies a buffer into one of a few page aligned slots and
+// returns; a writer thread writes the slots with O_DIRECT so the page
+// cache is not churned at the sensor data rate.  Each frame takes a whole
+// number of RECORD_ALIGN blocks and gets one line in the sidecar index
+// <file>.idx:		sequence  seconds  microseconds  offset  bytes  exposure
+// Close() appends the binary index and completes the header.
+// With Compress() the writer thread codes each frame losslessly with
+// RawCodec on a pool of its own, so capture never waits on the codec.
+// When every slot is still waiting for the disk the frame is dropped and
+// counted rather than holding up capture.
+#define RECORD_SLOTS 4		// frames in flight to the writer
+
+class RawRecorder
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	RawRecorder(int slots = RECORD_SLOTS);
+	~RawRecorder();
+	ERR Open(std::string fileName, int width, int height, int bits = 10);	// frames of width * height Y16
+	void Close();	// waits for the frames in flight
+	void Compress(bool enable){m_Compress = enable;};	// from the next Open()
+	bool Compressing(){return m_pCodec != NULL;};
+	bool Recording(){return m_fd >= 0;};
+	// capture thread, never waits for the disk, FAIL when the frame is dropped
+	ERR Push(const uint8_t *src, int srcLen, uint32_t sequence, struct timeval timestamp, int exposure);
+	// writes from the calling thread instead, for callers already in the background
+	// (not mixed with Push), coded frames come from RawCodec and need Compress()
+	ERR Append(const uint8_t *src, int srcLen, bool coded, uint32_t sequence, struct timeval timestamp, int exposure);
+	unsigned int Frames(){return m_Frames;};	// written
+	unsigned int Dropped(){return m_Dropped;};
+
+private:
+	typedef struct
+	{
+		uint8_t *pData;		// RECORD_ALIGN aligned, m_Stride bytes
+		int bytes;
+		uint32_t sequence;
+		struct timeval timestamp;
+		int exposure;
+	} SLOT;
+	static void *Writer(void *arg);
+	void Write(SLOT &slot);
+	void Store(uint8_t *pData, int bytes, uint32_t sequence, struct timeval timestamp, int exposure);
+	ERR WriteBlocks(const void *src, int bytes, uint64_t offset);	// bytes rounded up to RECORD_ALIGN
+
+	int m_fd;
+	FILE *m_pIndex;
+	int m_FrameBytes;
+	int m_Stride;		// m_FrameBytes rounded up to RECORD_ALIGN
+	std::vector<SLOT> m_Slots;
+	int m_Head;			// next slot to write
+	int m_Tail;			// next slot to fill
+	int m_Queued;
+	bool m_Quit;
+	bool m_Failed;
+	pthread_t m_Thread;
+	pthread_mutex_t m_Lock;
+	pthread_cond_t m_Ready;
+	unsigned int m_Frames;
+	unsigned int m_Dropped;
+	uint64_t m_Offset;	// of the next frame in the data file
+	RAW_HEADER m_Header;
+	bool m_Compress;
+	RawCodec *m_pCodec;		// while recording compressed
+	ThreadPool *m_pPool;	// the codec's strips
+	uint8_t *m_pCoded;		// RECORD_ALIGN aligned coded frame
+	int m_CodedRoom;
+	std::vector<RAW_ENTRY> m_Entries;	// the index, kept by the writer thread
+};
+
+#endif // RAWRECORDER_HEADER
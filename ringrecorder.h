@@ -0,0 +1,105 @@
+#ifndef RINGRECORDER_HEADER
+#define RINGRECORDER_HEADER
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include "rawcodec.h"
+#include "rawrecorder.h"
+#include "threadpool.h"
+
+// RingRecorder keeps the last few seconds of raw Y16 frames in memory so
+// an event can be saved together with what led up to it.  Everything is
+// allocated by Setup(): an arena of a fixed number of bytes holding the
+// frames back to back (coded with RawCodec when compressing), a few
+// staging slots and the frame table, so memory use does not move while
+// capturing.  Push() copies a frame into a staging slot and returns; a
+// background thread moves it into the arena, coding it on a pool of its
+// own and dropping the oldest frames to make room.
+// Trigger() saves the frames of the last preSeconds and those of the next
+// postSeconds to a recording (rawformat.h) from a second thread; frames
+// waiting to be saved are kept until they are written, and when they fill
+// the arena new frames are dropped rather than old ones lost.
+#define RING_STAGING 3			// frames between Push() and the arena
+#define RING_POST_SECONDS 2.0F	// saved after a trigger by default
+
+class RingRecorder
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	RingRecorder();
+	~RingRecorder();
+	ERR Setup(int width, int height, size_t arenaBytes, bool compress = false, int bits = 10);
+	void Release();
+	bool Ready(){return m_pArena != NULL;};
+	// capture thread, never waits, FAIL when the frame is dropped
+	ERR Push(const uint8_t *src, int srcLen, uint32_t sequence, struct timeval timestamp, int exposure);
+	// preSeconds < 0 saves everything held, FAIL while the last event is still being saved or the ring is empty
+	ERR Trigger(std::string fileName, float preSeconds = -1.0F, float postSeconds = RING_POST_SECONDS);
+	bool Saving(){return m_Saving;};
+	float Before(){return m_Before;};	// seconds held before the last trigger
+	int Frames();			// held in the arena
+	float Seconds();		// spanned by the frames held
+	unsigned int Dropped(){return m_Dropped;};
+
+private:
+	typedef struct
+	{
+		size_t offset;		// in the arena
+		int bytes;
+		uint32_t sequence;
+		struct timeval timestamp;
+		int exposure;
+		bool save;			// wanted by the event being saved
+	} FRAME;
+	typedef struct
+	{
+		uint8_t *pData;
+		int bytes;
+		uint32_t sequence;
+		struct timeval timestamp;
+		int exposure;
+	} STAGE;
+	static void *Ingest(void *arg);
+	static void *Saver(void *arg);
+	void Insert(STAGE &stage);
+	bool MakeRoom(int bytes, size_t &offset);	// with m_Lock held
+	FRAME &Held(int i){return m_Frames[(m_First + i) % m_Frames.size()];};	// 0 is the oldest
+
+	int m_Width, m_Height, m_Bits;
+	int m_FrameBytes;
+	uint8_t *m_pArena;
+	size_t m_ArenaBytes;
+	size_t m_Next;			// arena offset after the newest frame
+	std::vector<FRAME> m_Frames;	// circular, oldest at m_First
+	int m_First, m_Count;
+	std::vector<STAGE> m_Stages;	// circular
+	int m_StageHead, m_StageCount;
+	RawCodec *m_pCodec;
+	ThreadPool *m_pPool;
+	uint8_t *m_pCoded;		// one coded frame before it goes in the arena
+	int m_CodedRoom;
+	// the event being saved
+	std::string m_EventFile;
+	bool m_Saving;
+	float m_Before;
+	int64_t m_SaveUntil;	// microseconds, frames up to here are saved
+	RawRecorder m_Recorder;
+	// threads
+	bool m_Quit;
+	bool m_IngestStarted, m_SaverStarted;
+	pthread_t m_IngestThread, m_SaverThread;
+	pthread_mutex_t m_Lock;
+	pthread_cond_t m_Staged;
+	pthread_cond_t m_Saveable;
+	unsigned int m_Dropped;	// from the capture and ingest threads, atomic
+};
+
+#endif // RINGRECORDER_HEADER
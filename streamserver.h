@@ -0,0 +1,121 @@
+#ifndef STREAMSERVER_HEADER
+#define STREAMSERVER_HEADER
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "jpegencoder.h"
+
+// StreamServer serves the frames over HTTP from inside the capture binary:
+//	/				a page showing the stream
+//	/stream.mjpg	multipart MJPEG for browsers
+//	/frame.jpg		the newest frame as one JPEG
+//	/stream.y16		multipart raw Y16 frames for tools, each part has
+//					X-Width, X-Height and X-Sequence headers
+//	/frame.y16		the newest raw frame, with the same headers
+// Post() never waits: like the Viewfinder it only copies a frame when the
+// encoder thread is idle and some client wants that format.  The encoder
+// codes each frame once per format into a packet shared by every client
+// of that format.  One server thread accepts and sends to all the clients
+// on non-blocking sockets; a client still sending an older packet skips
+// to the newest once it is done, so a slow client loses frames instead of
+// holding up the others.  JPEG is coded in strips by a JpegEncoder on a
+// thread pool of its own, so it never waits for the capture thread's jobs.
+#define STREAM_PORT 8080
+#define STREAM_CLIENTS 16		// connections at once
+#define STREAM_QUALITY 80		// JPEG quality
+
+class StreamServer
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	StreamServer(int quality = STREAM_QUALITY);
+	~StreamServer();
+	ERR Start(int port = STREAM_PORT);	// all interfaces
+	void Stop();	// closes every connection
+	bool Running(){return m_Running;};
+	// capture thread, never blocks, RGB is CV_8UC3 or CV_16UC3, raw is width x height Y16
+	// range is that of the values of a 16 bit RGB, 1024 for linear 10 bit frames
+	void Post(const cv::Mat &RGB, const uint8_t *raw, int rawLen, int width, int height, uint32_t sequence, int range = 65536);
+	int Clients(){return m_ClientCount;};
+	unsigned int Encoded(){return m_Encoded;};	// frames coded, per format
+	unsigned int Dropped(){return m_Dropped;};	// frames slow clients skipped
+
+private:
+	typedef enum
+	{
+		FMT_JPEG = 0,
+		FMT_Y16,
+		FMT_COUNT
+	} FORMAT;
+	typedef struct
+	{
+		std::vector<uint8_t> data;	// multipart part: headers, payload, CRLF
+		size_t payload;				// offset of the payload in data
+		size_t payloadBytes;
+		std::string headers;		// X- headers of a single frame response
+		unsigned int serial;		// counts the packets of the format
+		int refs;					// the latest slot and each client sending it
+	} PACKET;
+	typedef struct
+	{
+		int fd;
+		std::string request;		// until the blank line
+		bool reading;
+		std::string head;			// response headers still to send
+		size_t headSent;
+		int format;
+		bool once;					// one frame then close
+		PACKET *pPacket;			// being sent
+		size_t sent, end;			// range of pPacket->data
+		unsigned int serial;		// of the last packet taken
+		bool any;					// a packet was taken
+	} CLIENT;
+	static void *ServerThread(void *arg);
+	static void *EncoderThread(void *arg);
+	void Serve();
+	void Accept();
+	bool Receive(CLIENT &client);	// false to close
+	bool Send(CLIENT &client);		// false to close
+	bool Pending(CLIENT &client);	// has bytes to send or a newer packet
+	bool Take(CLIENT &client);		// newest packet, false if none newer
+	void Encode();
+	void Publish(int format, PACKET *pPacket);
+	void Release(PACKET *pPacket);	// with m_Lock held
+	void Close(size_t i);
+
+	ThreadPool m_Pool;			// before m_Jpeg, which uses it
+	JpegEncoder m_Jpeg;
+	std::vector<unsigned char> m_JpegBytes;	// kept so its capacity is reused
+	int m_Listen;
+	int m_Wake[2];				// encoder to server thread pipe
+	pthread_t m_ServerThread, m_EncoderThread;
+	bool m_Running;
+	volatile bool m_Quit;
+	pthread_mutex_t m_Lock;		// guards the posted frame and the packets
+	pthread_cond_t m_Posted;
+	volatile bool m_Idle;		// encoder is waiting for a frame
+	volatile int m_Want;		// formats the clients want, bit per FORMAT
+	bool m_Ready;				// a frame was posted
+	int m_Formats;				// posted
+	cv::Mat m_RGB;
+	int m_Shift;				// of its 16 bit values to 8 bit
+	std::vector<uint8_t> m_Raw;
+	int m_Width, m_Height;
+	uint32_t m_Sequence;
+	PACKET *m_pLatest[FMT_COUNT];
+	unsigned int m_Serial[FMT_COUNT];
+	std::vector<CLIENT> m_Clients;	// server thread only
+	volatile int m_ClientCount;
+	unsigned int m_Encoded;
+	unsigned int m_Dropped;
+};
+
+#endif // STREAMSERVER_HEADER
@@ -0,0 +1,53 @@
+#ifndef TEMPORALFILTER_HEADER
+#define TEMPORALFILTER_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <opencv2/core/core.hpp>
+
+// TemporalFilter is a motion adaptive recursive (IIR) noise filter for one
+// extracted plane (RGB or IR, 8 or 16 bit).  It keeps a 16 bit accumulator
+// per element holding the filtered value with extra fraction bits and
+// updates it in place each frame:
+//		acc += alpha * (in - acc)	where |in - acc| <= threshold
+//		acc  = in					where it moved more than threshold
+// and writes the rounded accumulator back over the input plane.  Each
+// channel of the plane has its own alpha and threshold; a threshold of 0
+// passes that channel through unfiltered.
+#define TEMPORAL_MAX_CHANNELS 3
+
+class TemporalFilter
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	TemporalFilter(int bits = 10);	// significant bits of 16 bit planes
+	~TemporalFilter();
+	bool Enabled(){return m_Enabled;};
+	void Enable(bool enable){m_Enabled = enable; Reset();};
+	// alpha is the weight of the new frame (0..0.5], threshold in input units
+	void SetChannel(int channel, float alpha, int threshold);
+	void Reset(){m_Acc.release();};	// next frame restarts the filter
+	ERR Apply(cv::Mat &plane);	// filters the plane in place
+
+protected:
+	void Prepare(int type);	// fill the per lane weights for this plane type
+
+private:
+	bool m_Enabled;
+	int m_Bits16;	// significant bits of 16 bit input
+	int m_Frac;		// fraction bits in the accumulator
+	float m_Alpha[TEMPORAL_MAX_CHANNELS];
+	int m_Threshold[TEMPORAL_MAX_CHANNELS];
+	cv::Mat m_Acc;	// accumulator, same size and channels as the plane, 16 bit
+	// per lane weight (Q16) and threshold (accumulator units) repeated
+	// over 24 lanes so interleaved RGB lines up with three 8 lane vectors
+	short m_LaneWeight[24];
+	short m_LaneThreshold[24];
+	bool m_Prepared;
+};
+
+#endif // TEMPORALFILTER_HEADER
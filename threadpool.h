@@ -0,0 +1,42 @@
+#ifndef THREADPOOL_HEADER
+#define THREADPOOL_HEADER
+#include <pthread.h>
+#include <vector>
+
+// ThreadPool runs the parts of one job at a time on a fixed set of worker
+// threads.  Run() hands out part indices [0..count) to the workers and
+// to the calling thread, and returns once every part is done, so a job
+// may use the caller's stack for its arguments.  Parts are taken in
+// order, which suits strips of rows of an image.
+class ThreadPool
+{
+public:
+	typedef void (*TASK)(void *arg, int part);
+
+	ThreadPool(int threads = 0);	// total threads including the caller, 0 = one per CPU
+	~ThreadPool();
+	int Threads(){return m_Threads;};
+	void Run(TASK task, void *arg, int count);
+	static ThreadPool *Shared();	// process wide pool, one thread per CPU
+
+private:
+	static void *Worker(void *arg);
+	int Work(TASK task, void *arg, int count);	// returns the parts done
+
+	int m_Threads;
+	std::vector<pthread_t> m_Workers;
+	pthread_mutex_t m_RunLock;	// one job at a time
+	pthread_mutex_t m_Lock;		// guards the job state below
+	pthread_cond_t m_Start;
+	pthread_cond_t m_Done;
+	TASK m_Task;
+	void *m_Arg;
+	int m_Count;
+	volatile int m_Next;		// next part to hand out
+	int m_Finished;				// parts done
+	int m_Active;				// workers inside the current job
+	unsigned int m_Generation;	// bumped for each job
+	bool m_Quit;
+};
+
+#endif // THREADPOOL_HEADER
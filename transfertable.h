@@ -0,0 +1,85 @@
+#ifndef TRANSFERTABLE_HEADER
+#define TRANSFERTABLE_HEADER
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// TransferTable is a lookup table for a transfer curve (e.g. sRGB encoding)
+// from an input range of up to 65536 codes to 8 or 16 bit output codes.
+// Inputs at or above the range are clamped to its last entry, so any
+// unsigned short may be looked up safely.
+// Up to TRANSFER_DIRECT_MAX codes the table has one entry per input code.
+// Above that it is two level: the top bits of the input select a knot of a
+// TRANSFER_KNOTS knot table and the low bits interpolate linearly to the
+// next knot, which keeps 16 bit input tables L1 resident (8 KB) instead of
+// 128 KB for a direct table.
+// Tables are immutable once built, so one table per (curve, input range,
+// output bits) is shared by every user in the process through Get(), which
+// builds it on first use under a lock.
+#define TRANSFER_DIRECT_MAX 4096
+#define TRANSFER_KNOTS 4096
+
+class TransferTable
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+	typedef enum curves
+	{
+		CURVE_SRGB = 0,
+		CURVE_LINEAR,
+		CURVE_REC709,
+		CURVE_LOG,		// log2(1 + 255x) / 8, lifts shadows for grading
+		CURVE_USER		// piecewise linear through caller supplied points
+	} CURVE;
+
+	TransferTable();
+	~TransferTable();
+	ERR Build(CURVE curve, int inputRange, int outputBits);
+	// user curve through n points evenly spaced over [0..1], values in [0..1]
+	// (not shared through Get(), the caller owns it)
+	ERR BuildUser(const float *points, int n, int inputRange, int outputBits);
+	// shared table from the process wide cache, NULL if it can not be built
+	static const TransferTable *Get(CURVE curve, int inputRange, int outputBits);
+	bool Matches(CURVE curve, int inputRange, int outputBits) const
+	{
+		return (curve == m_Curve) && (inputRange == m_Range) && (outputBits == m_OutputBits);
+	};
+	int InputRange() const {return m_Range;};
+	int OutputBits() const {return m_OutputBits;};
+	static double Evaluate(CURVE curve, double x);	// x and result in [0..1], not CURVE_USER
+	inline int Lookup(int v) const
+	{
+		v = (v < m_Range) ? v : m_Range - 1;
+		if (m_Shift == 0)
+			return m_pTable[v];
+		int i = v >> m_Shift;
+		int f = v & m_Mask;
+		return m_pTable[i] + ((((int)m_pTable[i + 1] - (int)m_pTable[i]) * f + m_Round) >> m_Shift);
+	};
+	// apply to n elements, src and dst may be the same (16 bit input
+	// uses AVX2 gathers where the CPU has them)
+	void Apply(const unsigned short *src, unsigned short *dst, int n) const;
+	void Apply(const unsigned char *src, unsigned char *dst, int n) const;
+
+private:
+	// m_pTable points into m_Table, so tables are not copied
+	TransferTable(const TransferTable &);
+	TransferTable &operator=(const TransferTable &);
+	ERR Fill(int inputRange, int outputBits);	// m_Table from Value()
+	double Value(double x);	// this table's curve, including user points
+	CURVE m_Curve;
+	std::vector<float> m_Points;	// CURVE_USER points
+	int m_Range;
+	int m_OutputBits;
+	int m_Shift;	// 0 for a direct table, else input bits below the knot index
+	int m_Mask;
+	int m_Round;
+	std::vector<unsigned short> m_Table;	// entries or knots (with one past the end)
+	const unsigned short *m_pTable;
+};
+
+#endif // TRANSFERTABLE_HEADER
@@ -0,0 +1,81 @@
+#ifndef VIDEOENCODER_HEADER
+#define VIDEOENCODER_HEADER
+#include <pthread.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace cv
+{
+	class VideoWriter;	// highgui
+}
+
+// VideoEncoder takes video output off the capture loop.  Push() copies a
+// frame into one of a fixed number of queue slots and returns; a writer
+// thread scales the slots to the video size and feeds them to a
+// cv::VideoWriter in order.  When
+// the writer falls behind and the queue is full the policy decides:
+// ENCODE_DROP loses the new frame, ENCODE_BLOCK waits for a slot and
+// counts the wait.  Stats() reports the encode times and queue depth.
+// A VideoWriter takes one frame at a time, so there is one writer thread.
+// It needs highgui and is left out of HEADLESS builds.
+#define ENCODE_QUEUE 4		// frames waiting for the writer
+
+typedef struct
+{
+	unsigned int frames;	// written
+	unsigned int dropped;	// queue full, ENCODE_DROP
+	unsigned int blocked;	// queue full, ENCODE_BLOCK
+	float blockedMs;		// total wait in Push()
+	float encodeMs;			// mean per frame
+	float encodeMsMax;
+	int depth;				// frames queued now
+	int depthMax;
+} ENCODE_STATS;
+
+class VideoEncoder
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+	typedef enum
+	{
+		ENCODE_DROP = 0,
+		ENCODE_BLOCK
+	} POLICY;
+
+	VideoEncoder(int slots = ENCODE_QUEUE, POLICY policy = ENCODE_DROP);
+	~VideoEncoder();
+	// frames pushed later are scaled to frameSize (nearest) by the writer thread
+	ERR Open(std::string fileName, int fourcc, double fps, cv::Size frameSize, int type, bool isColor = true);
+	void Close();	// writes what is queued first
+	bool IsOpen(){return m_Running;};
+	void SetPolicy(POLICY policy){m_Policy = policy;};
+	ERR Push(const cv::Mat &frame);	// capture thread, FAIL when dropped
+	void Stats(ENCODE_STATS &stats);
+	void PrintStats();
+
+private:
+	static void *Thread(void *arg);
+
+	POLICY m_Policy;
+	std::vector<cv::Mat> m_Slots;	// allocated by Open(), sized by the first frame
+	cv::Size m_FrameSize;			// of the video
+	cv::Mat m_Scaled;				// writer thread only
+	int m_Head, m_Count;
+	cv::VideoWriter *m_pWriter;
+	pthread_t m_Thread;
+	bool m_Running;
+	bool m_Quit;
+	pthread_mutex_t m_Lock;
+	pthread_cond_t m_Queued;
+	pthread_cond_t m_Space;
+	ENCODE_STATS m_Stats;
+	double m_EncodeMs;				// total
+};
+
+#endif // VIDEOENCODER_HEADER
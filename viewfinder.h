@@ -0,0 +1,52 @@
+#ifndef VIEWFINDER_HEADER
+#define VIEWFINDER_HEADER
+#include <pthread.h>
+#include <stdio.h>
+#include <deque>
+#include <opencv2/core/core.hpp>
+
+// Viewfinder shows the B, G, R, RGB and IR windows on a thread of its own
+// so drawing and GUI event handling never hold up capture.  The display
+// thread asks for a frame when it is ready to draw; Post() only copies a
+// frame while one is wanted and never waits, so at high capture rates the
+// windows show a sample of the stream at the refresh rate.  Keys pressed
+// in the windows are queued for the capture thread to read with Key().
+#define VIEW_REFRESH_HZ 30
+
+class Viewfinder
+{
+public:
+	typedef enum errors
+	{
+		OK = 0,
+		FAIL
+	} ERR;
+
+	Viewfinder(int refreshHz = VIEW_REFRESH_HZ);
+	~Viewfinder();
+	ERR Start();
+	void Stop();	// closes the windows
+	bool Running(){return m_Running;};
+	void SetRefresh(int refreshHz);
+	void Post(const cv::Mat &RGB, const cv::Mat &IR);	// capture thread, never blocks
+	int Key();	// next key pressed in the windows, -1 when there is none
+	unsigned int Shown(){return m_Shown;};	// frames drawn
+
+private:
+	static void *Thread(void *arg);
+	void Show(cv::Mat &RGB, cv::Mat &IR);
+
+	pthread_t m_Thread;
+	pthread_mutex_t m_Lock;		// guards the frame and key queue
+	bool m_Running;
+	volatile bool m_Quit;
+	volatile bool m_Wanted;		// display is waiting for a frame
+	bool m_Ready;				// m_RGB, m_IR hold a frame not yet shown
+	int m_PeriodMs;
+	cv::Mat m_RGB;
+	cv::Mat m_IR;
+	std::deque<int> m_Keys;
+	unsigned int m_Shown;
+};
+
+#endif // VIEWFINDER_HEADER